@@ -17,6 +17,7 @@ class IsCamerasConan(ConanFile):
     generators = "cmake", "cmake_find_package", "cmake_paths"
     requires = (
         "opencv/3.4.2@is/stable",
+        "libjpeg-turbo/1.5.2@bincrafters/stable",
         "is-wire/1.1.4@is/stable",
         "is-msgs/1.1.8@is/stable",
         "zipkin-cpp-opentracing/0.3.1@is/stable",
@@ -0,0 +1,28 @@
+#include "downscale.hpp"
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "is/camera-drivers/utils/utils.hpp"
+
+namespace is {
+namespace camera {
+
+void downscale(Frame const& source, Frame* half, AllocationCounter* allocations) {
+  auto mono = source.format == PixelFormat::MONO8;
+  auto type = mono ? CV_8UC1 : CV_8UC3;
+  half->width = source.width / 2;
+  half->height = source.height / 2;
+  half->stride = half->width * (mono ? 1 : 3);
+  half->format = source.format;
+  half->timestamp = source.timestamp;
+  auto capacity = half->data.capacity();
+  half->data.resize(half->stride * half->height);
+  allocations->track(capacity, half->data);
+
+  cv::Mat from(source.height, source.width, type, const_cast<unsigned char*>(source.data.data()), source.stride);
+  cv::Mat to(half->height, half->width, type, half->data.data(), half->stride);
+  // the destination already has the right size and type, so resize writes straight into 'half'
+  cv::resize(from, to, to.size(), 0, 0, cv::INTER_AREA);
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "is/camera-drivers/interface/camera-driver.hpp"
+#include "is/camera-drivers/utils/utils.hpp"
+
+namespace is {
+namespace camera {
+
+// Halves both dimensions of 'source' into 'half', averaging each 2x2 block. 'half' keeps its buffer
+// between calls, so the levels of a pyramid can be rebuilt on every frame without allocating, which
+// 'allocations' keeps track of.
+void downscale(Frame const& source, Frame* half, AllocationCounter* allocations);
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,251 @@
+#include "encoder.hpp"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "is/camera-drivers/utils/utils.hpp"
+#include "raw-image.pb.h"
+
+namespace is {
+namespace camera {
+
+void set_compression_parm(ImageFormats format, float value, std::vector<int>* parm) {
+  parm->clear();
+  if (format == ImageFormats::PNG) {
+    parm->push_back(cv::IMWRITE_PNG_COMPRESSION);
+    int level = value * (9 - 0) + 0;
+    parm->push_back(level);
+  } else if (format == ImageFormats::JPEG) {
+    parm->push_back(cv::IMWRITE_JPEG_QUALITY);
+    int level = value * (100 - 0) + 0;
+    parm->push_back(level);
+  } else if (format == ImageFormats::WebP) {
+    parm->push_back(cv::IMWRITE_WEBP_QUALITY);
+    int level = value * (100 - 1) + 1;
+    parm->push_back(level);
+  }
+}
+
+std::vector<int> get_compression_parm(ImageFormat const& image_format) {
+  std::vector<int> parm;
+  if (image_format.has_compression())
+    set_compression_parm(image_format.format(), image_format.compression().value(), &parm);
+  return parm;
+}
+
+// Level matching what cv::imencode does when no compression is given.
+float default_compression(ImageFormats format) {
+  if (format == ImageFormats::PNG)
+    return 3.0 / 9.0;
+  if (format == ImageFormats::JPEG)
+    return 0.95;
+  return 1.0;
+}
+
+void serialize_image(std::vector<unsigned char> const& data, std::string* payload, CopyCounter* copies) {
+  using WireFormatLite = google::protobuf::internal::WireFormatLite;
+  using CodedOutputStream = google::protobuf::io::CodedOutputStream;
+  // is::vision::Image is a single length delimited field, so the encoded bytes are written once after
+  // their tag and length, without building an Image and serializing it again
+  unsigned char header[16];
+  auto end = CodedOutputStream::WriteTagToArray(
+      WireFormatLite::MakeTag(Image::kDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED), header);
+  end = CodedOutputStream::WriteVarint32ToArray(data.size(), end);
+  payload->clear();
+  payload->reserve((end - header) + data.size());
+  payload->append(header, end);
+  payload->append(data.begin(), data.end());
+  copies->add(data.size());
+}
+
+void serialize_raw(FrameView const& view, std::string* payload, CopyCounter* copies) {
+  using WireFormatLite = google::protobuf::internal::WireFormatLite;
+  using CodedOutputStream = google::protobuf::io::CodedOutputStream;
+  auto format = view.format == PixelFormat::MONO8
+                    ? RawPixelFormats::MONO8
+                    : view.format == PixelFormat::RGB8 ? RawPixelFormats::RGB8 : RawPixelFormats::BGR8;
+  // regions are packed row by row, a whole frame keeps its stride and goes in a single copy
+  auto row_size = static_cast<std::size_t>(view.width * view.channels());
+  auto packed = row_size != static_cast<std::size_t>(view.stride);
+  auto stride = packed ? row_size : view.stride;
+  auto size = stride * view.height;
+  // same as serialize_image, with the pixel layout ahead of the data
+  unsigned char header[64];
+  auto end = WireFormatLite::WriteUInt32ToArray(RawImage::kWidthFieldNumber, view.width, header);
+  end = WireFormatLite::WriteUInt32ToArray(RawImage::kHeightFieldNumber, view.height, end);
+  end = WireFormatLite::WriteUInt32ToArray(RawImage::kStrideFieldNumber, stride, end);
+  end = WireFormatLite::WriteEnumToArray(RawImage::kFormatFieldNumber, format, end);
+  end = CodedOutputStream::WriteTagToArray(
+      WireFormatLite::MakeTag(RawImage::kDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED), end);
+  end = CodedOutputStream::WriteVarint32ToArray(size, end);
+  payload->clear();
+  payload->reserve((end - header) + size);
+  payload->append(header, end);
+  auto data = reinterpret_cast<char const*>(view.data);
+  if (packed) {
+    for (int row = 0; row < view.height; ++row) {
+      payload->append(data + row * view.stride, row_size);
+    }
+  } else {
+    payload->append(data, size);
+  }
+  copies->add(size);
+}
+
+// Room left before a JPEG written in place: the tag plus a length padded to the longest 32 bit varint.
+// Parsers accept the redundant continuation bytes, so the length can be filled in after compressing.
+constexpr std::size_t padded_header_size = 6;
+
+void write_padded_header(std::string* payload) {
+  using WireFormatLite = google::protobuf::internal::WireFormatLite;
+  auto length = payload->size() - padded_header_size;
+  auto header = reinterpret_cast<unsigned char*>(&(*payload)[0]);
+  header[0] = WireFormatLite::MakeTag(Image::kDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  for (std::size_t i = 0; i < padded_header_size - 1; ++i) {
+    header[i + 1] = (length >> (7 * i)) & 0x7F;
+    if (i < padded_header_size - 2)
+      header[i + 1] |= 0x80;
+  }
+}
+
+std::shared_ptr<FrameEncoder::Settings const> FrameEncoder::make_settings(ImageFormat const& imgf,
+                                                                          JpegParameters const& jpeg, bool raw) {
+  auto settings = std::make_shared<Settings>();
+  settings->raw = raw;
+  settings->format = imgf.format();
+  settings->compression = imgf.has_compression() ? imgf.compression().value() : default_compression(imgf.format());
+  settings->extension = fmt::format(".{}", ImageFormats_Name(imgf.format()));
+  settings->parameters = get_compression_parm(imgf);
+  settings->native_jpeg = imgf.format() == ImageFormats::JPEG;
+  settings->quality = static_cast<int>(settings->compression * 100);
+  settings->jpeg = jpeg;
+  return settings;
+}
+
+FrameEncoder::FrameEncoder(FrameCounters* counters)
+    : counters(counters), raw(false), adapted_compression(-1.0f) {
+  ImageFormat imgf;
+  imgf.set_format(ImageFormats::JPEG);
+  this->set_format(imgf);
+}
+
+Status FrameEncoder::set_format(ImageFormat const& imgf) {
+  if (imgf.has_compression()) {
+    auto value = imgf.compression().value();
+    if (value < 0.0 || value > 1.0) {
+      auto why = fmt::format("Compression level equals to {} is out of range. Must be: [0.0,1.0]", value);
+      return internal_error(StatusCode::OUT_OF_RANGE, why);
+    }
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->image_format = imgf;
+  this->settings = make_settings(this->image_format, this->jpeg_parameters, this->raw);
+  return is::make_status(StatusCode::OK);
+}
+
+void FrameEncoder::set_adapted_compression(float compression) {
+  this->adapted_compression.store(std::min(compression, 1.0f), std::memory_order_relaxed);
+}
+
+float FrameEncoder::compression() const {
+  auto adapted = this->adapted_compression.load(std::memory_order_relaxed);
+  if (adapted >= 0.0f)
+    return adapted;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->settings->compression;
+}
+
+bool FrameEncoder::compression_grows_payload() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->settings->format != ImageFormats::PNG;
+}
+
+void FrameEncoder::set_raw(bool raw) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->raw = raw;
+  this->settings = make_settings(this->image_format, this->jpeg_parameters, this->raw);
+}
+
+void FrameEncoder::set_jpeg_parameters(JpegParameters const& parameters) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->jpeg_parameters = parameters;
+  this->settings = make_settings(this->image_format, this->jpeg_parameters, this->raw);
+}
+
+ImageFormat FrameEncoder::format() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->image_format;
+}
+
+Status FrameEncoder::encode(Frame const& frame, std::string* payload) const {
+  return this->encode(FrameView(frame), payload);
+}
+
+Status FrameEncoder::encode(Frame const& frame, Region const& region, std::string* payload) const {
+  FrameView view(frame, region);
+  if (view.empty()) {
+    auto why = fmt::format("[Encode] Region {}x{}+{}+{} is outside the {}x{} frame", region.width, region.height,
+                           region.x, region.y, frame.width, frame.height);
+    return internal_error(StatusCode::OUT_OF_RANGE, why);
+  }
+  return this->encode(view, payload);
+}
+
+Status FrameEncoder::encode(FrameView const& view, std::string* payload) const {
+  std::shared_ptr<Settings const> settings;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    settings = this->settings;
+  }
+  auto adapted = this->adapted_compression.load(std::memory_order_relaxed);
+
+  auto capacity = payload->capacity();
+  if (settings->raw) {
+    serialize_raw(view, payload, &this->counters->copies);
+    this->counters->allocations.track(capacity, *payload);
+    return is::make_status(StatusCode::OK);
+  }
+
+  if (settings->native_jpeg) {
+    thread_local JpegCompressor compressor;
+    auto quality = adapted >= 0.0f ? static_cast<int>(adapted * 100) : settings->quality;
+    auto status =
+        compressor.compress(view, quality, settings->jpeg, payload, padded_header_size, &this->counters->allocations);
+    if (status.code() != StatusCode::OK) {
+      payload->clear();
+      return status;
+    }
+    write_padded_header(payload);
+    this->counters->allocations.track(capacity, *payload);
+    return status;
+  }
+
+  auto type = view.format == PixelFormat::MONO8 ? CV_8UC1 : CV_8UC3;
+  cv::Mat mat(view.height, view.width, type, const_cast<unsigned char*>(view.data), view.stride);
+  if (view.format == PixelFormat::RGB8) {
+    thread_local cv::Mat bgr;
+    cv::cvtColor(mat, bgr, cv::COLOR_RGB2BGR);
+    mat = bgr;
+  }
+  // one per worker thread, imencode writes into it without releasing the capacity of the previous frame
+  thread_local std::vector<unsigned char> image_data;
+  auto data_capacity = image_data.capacity();
+  auto parameters = &settings->parameters;
+  if (adapted >= 0.0f) {
+    thread_local std::vector<int> adapted_parameters;
+    set_compression_parm(settings->format, adapted, &adapted_parameters);
+    parameters = &adapted_parameters;
+  }
+  if (!cv::imencode(settings->extension, mat, image_data, *parameters)) {
+    auto why = fmt::format("[Encode] Failed to encode {} image", settings->extension);
+    return internal_error(StatusCode::INTERNAL_ERROR, why);
+  }
+  this->counters->allocations.track(data_capacity, image_data);
+  serialize_image(image_data, payload, &this->counters->copies);
+  this->counters->allocations.track(capacity, *payload);
+  return is::make_status(StatusCode::OK);
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "frame-view.hpp"
+#include "is/camera-drivers/interface/camera-driver.hpp"
+#include "is/camera-drivers/utils/utils.hpp"
+#include "jpeg-compressor.hpp"
+
+namespace is {
+namespace camera {
+
+// Driver agnostic compression of raw frames. Thread-safe, so the same instance can be shared by
+// all encoding workers while the format is changed through SetConfig. JPEG goes through a libjpeg
+// compressor kept by each worker thread, the other formats through OpenCV. In raw mode frames are
+// not compressed at all and go out as is::camera::RawImage (see interface/conf/raw-image.proto).
+class FrameEncoder {
+ public:
+  // Copies and allocations made while encoding are accounted in 'counters'.
+  explicit FrameEncoder(FrameCounters* counters);
+
+  Status set_format(ImageFormat const& imgf);
+  ImageFormat format() const;
+  void set_jpeg_parameters(JpegParameters const& parameters);
+  // Overrides the compression level of the image format, cheap enough to be called on every frame.
+  // Negative values give control back to the image format.
+  void set_adapted_compression(float compression);
+  // Level applied to the next frame and whether raising it makes payloads larger (JPEG and WebP
+  // quality) or smaller (PNG level).
+  float compression() const;
+  bool compression_grows_payload() const;
+  // Ignores the image format and publishes the sensor buffer with its layout instead.
+  void set_raw(bool raw);
+  // Writes a serialized is::vision::Image, or RawImage, straight into 'payload', ready to be used as message body.
+  Status encode(Frame const& frame, std::string* payload) const;
+  // Encodes only 'region' of the frame, read in place.
+  Status encode(Frame const& frame, Region const& region, std::string* payload) const;
+
+ private:
+  Status encode(FrameView const& view, std::string* payload) const;
+
+  // derived from image_format once, instead of on every frame
+  struct Settings {
+    std::string extension;
+    std::vector<int> parameters;
+    ImageFormats format;
+    float compression;
+    bool raw;
+    bool native_jpeg;
+    int quality;
+    JpegParameters jpeg;
+  };
+  static std::shared_ptr<Settings const> make_settings(ImageFormat const& imgf, JpegParameters const& jpeg, bool raw);
+
+  FrameCounters* counters;
+  mutable std::mutex mutex;
+  ImageFormat image_format;
+  JpegParameters jpeg_parameters;
+  bool raw;
+  // replaced as a whole on set_format, so encode only takes a reference instead of copying it
+  std::shared_ptr<Settings const> settings;
+  std::atomic<float> adapted_compression;
+};
+
+}  // namespace camera
+}  // namespace is
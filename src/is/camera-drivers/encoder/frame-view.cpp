@@ -0,0 +1,20 @@
+#include "frame-view.hpp"
+#include <algorithm>
+
+namespace is {
+namespace camera {
+
+FrameView::FrameView(Frame const& frame)
+    : data(frame.data.data()), width(frame.width), height(frame.height), stride(frame.stride), format(frame.format) {}
+
+FrameView::FrameView(Frame const& frame, Region const& region) : FrameView(frame) {
+  auto x = std::max(region.x, 0);
+  auto y = std::max(region.y, 0);
+  this->width = std::min(region.x + region.width, frame.width) - x;
+  this->height = std::min(region.y + region.height, frame.height) - y;
+  if (!this->empty())
+    this->data += y * this->stride + x * this->channels();
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "is/camera-drivers/interface/camera-driver.hpp"
+
+namespace is {
+namespace camera {
+
+// Rectangle of a frame, in pixels.
+struct Region {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Pixels handed to the encoders: a whole frame or a region of it, which keeps the stride of the frame
+// so it can be cut without copying. Does not own the pixels, the frame must outlive it.
+struct FrameView {
+  explicit FrameView(Frame const& frame);
+  // 'region' is clipped to the frame, the view is empty if they do not overlap
+  FrameView(Frame const& frame, Region const& region);
+
+  bool empty() const { return this->width <= 0 || this->height <= 0; }
+  int channels() const { return this->format == PixelFormat::MONO8 ? 1 : 3; }
+
+  unsigned char const* data;
+  int width;
+  int height;
+  int stride;
+  PixelFormat format;
+};
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,115 @@
+#include "jpeg-compressor.hpp"
+#include <csetjmp>
+#include "is/camera-drivers/utils/utils.hpp"
+
+namespace is {
+namespace camera {
+
+// libjpeg aborts the process on errors by default, instead jump back to compress and report it.
+struct JpegCompressor::ErrorManager {
+  jpeg_error_mgr manager;
+  std::jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+
+  static void on_error(j_common_ptr info) {
+    auto self = reinterpret_cast<ErrorManager*>(info->err);
+    (*info->err->format_message)(info, self->message);
+    std::longjmp(self->jump, 1);
+  }
+};
+
+// Writes the compressed stream straight into the payload, growing it when the SDK runs out of room.
+struct JpegCompressor::Destination {
+  jpeg_destination_mgr manager;
+  std::string* payload;
+  std::size_t offset;
+  std::size_t size_hint;
+
+  static void init(j_compress_ptr info) {
+    auto self = reinterpret_cast<Destination*>(info->dest);
+    auto size = std::max(self->payload->capacity(), self->offset + self->size_hint);
+    self->payload->resize(size);
+    self->manager.next_output_byte = reinterpret_cast<JOCTET*>(&(*self->payload)[self->offset]);
+    self->manager.free_in_buffer = size - self->offset;
+  }
+
+  static boolean grow(j_compress_ptr info) {
+    auto self = reinterpret_cast<Destination*>(info->dest);
+    auto size = self->payload->size();
+    self->payload->resize(2 * size);
+    self->manager.next_output_byte = reinterpret_cast<JOCTET*>(&(*self->payload)[size]);
+    self->manager.free_in_buffer = size;
+    return TRUE;
+  }
+
+  static void term(j_compress_ptr info) {
+    auto self = reinterpret_cast<Destination*>(info->dest);
+    self->payload->resize(self->payload->size() - self->manager.free_in_buffer);
+  }
+};
+
+JpegCompressor::JpegCompressor() : error(new ErrorManager), destination(new Destination) {
+  this->compressor.err = jpeg_std_error(&this->error->manager);
+  this->error->manager.error_exit = &ErrorManager::on_error;
+  jpeg_create_compress(&this->compressor);
+
+  this->destination->manager.init_destination = &Destination::init;
+  this->destination->manager.empty_output_buffer = &Destination::grow;
+  this->destination->manager.term_destination = &Destination::term;
+  this->compressor.dest = &this->destination->manager;
+}
+
+JpegCompressor::~JpegCompressor() {
+  jpeg_destroy_compress(&this->compressor);
+}
+
+Status JpegCompressor::compress(FrameView const& view, int quality, JpegParameters const& parameters,
+                                std::string* payload, std::size_t offset, AllocationCounter* allocations) {
+  auto capacity = this->rows.capacity();
+  this->rows.resize(view.height);
+  allocations->track(capacity, this->rows);
+  auto data = const_cast<unsigned char*>(view.data);
+  for (int row = 0; row < view.height; ++row) {
+    this->rows[row] = data + row * view.stride;
+  }
+
+  this->destination->payload = payload;
+  this->destination->offset = offset;
+  // a quarter of the raw size is plenty for the first frame, later ones reuse the payload capacity
+  this->destination->size_hint = view.width * view.height * view.channels() / 4 + 1024;
+
+  if (setjmp(this->error->jump)) {
+    jpeg_abort_compress(&this->compressor);
+    return internal_error(StatusCode::INTERNAL_ERROR, fmt::format("[Encode] {}", this->error->message));
+  }
+
+  auto& info = this->compressor;
+  info.image_width = view.width;
+  info.image_height = view.height;
+  // the sensor layout is handed to libjpeg as is, no conversion before compressing
+  if (view.format == PixelFormat::MONO8) {
+    info.input_components = 1;
+    info.in_color_space = JCS_GRAYSCALE;
+  } else {
+    info.input_components = 3;
+    info.in_color_space = view.format == PixelFormat::RGB8 ? JCS_EXT_RGB : JCS_EXT_BGR;
+  }
+  jpeg_set_defaults(&info);
+  jpeg_set_quality(&info, quality, TRUE);
+  info.optimize_coding = parameters.optimize_huffman ? TRUE : FALSE;
+  info.dct_method = parameters.fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+  if (info.input_components == 3) {
+    info.comp_info[0].h_samp_factor = parameters.subsampling == ChromaSubsampling::S444 ? 1 : 2;
+    info.comp_info[0].v_samp_factor = parameters.subsampling == ChromaSubsampling::S420 ? 2 : 1;
+  }
+
+  jpeg_start_compress(&info, TRUE);
+  while (info.next_scanline < info.image_height) {
+    jpeg_write_scanlines(&info, &this->rows[info.next_scanline], info.image_height - info.next_scanline);
+  }
+  jpeg_finish_compress(&info);
+  return is::make_status(StatusCode::OK);
+}
+
+}  // namespace camera
+}  // namespace is
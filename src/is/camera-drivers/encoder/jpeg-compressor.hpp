@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <jpeglib.h>
+#include "frame-view.hpp"
+#include "is/camera-drivers/utils/utils.hpp"
+
+namespace is {
+namespace camera {
+
+enum class ChromaSubsampling { S420, S422, S444 };
+
+// JPEG options that is::vision::ImageFormat has no field for.
+struct JpegParameters {
+  ChromaSubsampling subsampling = ChromaSubsampling::S420;
+  // second pass to build optimal huffman tables, smaller files for a bit more encode time
+  bool optimize_huffman = false;
+  // integer DCT with less accuracy, faster on cores without SIMD
+  bool fast_dct = false;
+};
+
+// libjpeg compressor whose state is created once and reused for every frame. Not thread-safe,
+// each encoding thread is meant to own one.
+class JpegCompressor {
+ public:
+  JpegCompressor();
+  ~JpegCompressor();
+  JpegCompressor(JpegCompressor const&) = delete;
+  JpegCompressor& operator=(JpegCompressor const&) = delete;
+
+  // Compresses 'view' into 'payload' starting at byte 'offset', bytes before it are left for the caller.
+  Status compress(FrameView const& view, int quality, JpegParameters const& parameters, std::string* payload,
+                  std::size_t offset, AllocationCounter* allocations);
+
+ private:
+  struct ErrorManager;
+  struct Destination;
+
+  jpeg_compress_struct compressor;
+  std::unique_ptr<ErrorManager> error;
+  std::unique_ptr<Destination> destination;
+  std::vector<JSAMPROW> rows;
+};
+
+}  // namespace camera
+}  // namespace is
@@ -1,9 +1,7 @@
 #include "driver.hpp"
 #include <google/protobuf/util/message_differencer.h>
-#include <opencv2/core.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/imgproc.hpp>
 #include "internal/info.hpp"
+#include "internal/modes.hpp"
 #include "internal/nodes.hpp"
 
 namespace is {
@@ -11,7 +9,15 @@ namespace camera {
 
 namespace fc = FlyCapture2;
 
-FlyCapture2Driver::FlyCapture2Driver() : uid(new fc::PGRGuid()), is_capturing(false) {
+FlyCapture2Driver::FlyCapture2Driver(std::string const& mode_cache)
+    : uid(new fc::PGRGuid()),
+      mode_cache(mode_cache),
+      is_capturing(false),
+      cycle_time(false),
+      cycle_started(false),
+      cycle_epoch_ns(0),
+      last_cycle_ns(0),
+      counters(nullptr) {
   this->color_space_map.insert(ColorSpaceBimap::value_type(ColorSpaces::GRAY, fc::PIXEL_FORMAT_MONO8));
   this->color_space_map.insert(ColorSpaceBimap::value_type(ColorSpaces::RGB, fc::PIXEL_FORMAT_RGB8));
 }
@@ -43,53 +49,57 @@ std::vector<CameraInfo> FlyCapture2Driver::find_cameras() {
   return cam_infos;
 }
 
-void FlyCapture2Driver::connect(CameraInfo const& cam_info) {
+Status FlyCapture2Driver::connect(CameraInfo const& cam_info) {
   fc::BusManager bus;
   auto error = bus.GetCameraFromSerialNumber(std::stoul(cam_info.serial_number()), this->uid);
   if (error != fc::PGRERROR_OK)
-    is::critical("[Camera Initialize] {}", error.GetDescription());
+    return internal_error(StatusCode::NOT_FOUND, fmt::format("[Camera Initialize] {}", error.GetDescription()));
   error = camera.Connect(this->uid);
   if (error != fc::PGRERROR_OK)
-    is::critical("[Camera Connection] {} ", error.GetDescription());
-
-  // retrieve available resolutions
-  for (auto i = 0; i < fc::NUM_MODES; ++i) {
-    bool is_available;
-    auto error = this->camera.QueryGigEImagingMode(static_cast<fc::Mode>(i), &is_available);
-    if (error != fc::PGRERROR_OK)
-      continue;
-    if (!is_available)
-      continue;
-    error = this->camera.SetGigEImagingMode(static_cast<fc::Mode>(i));
-    if (error != fc::PGRERROR_OK)
-      continue;
-    fc::Format7Info f7info;
-    bool supported;
-    fc::Camera _camera;
+    return internal_error(StatusCode::UNAVAILABLE, fmt::format("[Camera Connection] {}", error.GetDescription()));
+  fc::CameraInfo fc_info;
+  error = this->camera.GetCameraInfo(&fc_info);
+  if (error != fc::PGRERROR_OK)
+    return internal_error(StatusCode::UNAVAILABLE, fmt::format("[Camera Info] {}", error.GetDescription()));
+  auto ip = make_ip_address(fc_info.ipAddress);
+  if (cam_info.has_ethernet() && !cam_info.ethernet().ip_address().empty() && ip != cam_info.ethernet().ip_address()) {
     this->camera.Disconnect();
-    _camera.Connect(this->uid);
-    error = _camera.GetFormat7Info(&f7info, &supported);
-    _camera.Disconnect();
-    this->camera.Connect(this->uid);
-    if (error != fc::PGRERROR_OK)
-      continue;
-    auto has_mono8 = f7info.pixelFormatBitField & fc::PIXEL_FORMAT_MONO8;
-    auto has_rgb8 = f7info.pixelFormatBitField & fc::PIXEL_FORMAT_RGB8;
-    if (!(has_mono8) || !(has_rgb8))
-      continue;
-    fc::GigEImageSettingsInfo info;
-    error = this->camera.GetGigEImageSettingsInfo(&info);
-    if (error != fc::PGRERROR_OK)
-      continue;
-    Resolution res;
-    res.set_width(info.maxWidth);
-    res.set_height(info.maxHeight);
-    this->resolutions.push_back(std::make_pair(res, static_cast<fc::Mode>(i)));
+    auto why = fmt::format("[Camera Connection] Camera {} is at {}, not {}", cam_info.serial_number(), ip,
+                           cam_info.ethernet().ip_address());
+    return internal_error(StatusCode::FAILED_PRECONDITION, why);
   }
-  auto pos = std::unique(this->resolutions.begin(), this->resolutions.end(), [](auto& lhs, auto& rhs) {
-    return google::protobuf::util::MessageDifferencer::Equivalent(lhs.first, rhs.first);
-  });
-  this->resolutions.erase(pos, this->resolutions.end());
+  this->written.clear();
+
+  // the seconds and microseconds of frame timestamps come from the host, only the cycle timer is the
+  // camera clock and it is only filled in while embedded timestamps are on
+  fc::EmbeddedImageInfo embedded;
+  error = this->camera.GetEmbeddedImageInfo(&embedded);
+  this->cycle_time = error == fc::PGRERROR_OK && embedded.timestamp.available;
+  if (this->cycle_time) {
+    embedded.timestamp.onOff = true;
+    error = this->camera.SetEmbeddedImageInfo(&embedded);
+    this->cycle_time = error == fc::PGRERROR_OK;
+  }
+  if (!this->cycle_time)
+    is::warn("[Camera Connection] No embedded timestamps, frames are stamped with the host clock");
+  this->cycle_started = false;
+  this->cycle_epoch_ns = 0;
+
+  // retrieve available resolutions, probing every mode only the first time a model and firmware is seen
+  this->mode_key = make_mode_key(fc_info);
+  ModeTable modes;
+  auto cached = load_mode_table(this->mode_cache, this->mode_key, &modes);
+  if (cached && !this->check_modes(modes)) {
+    is::warn("[Imaging Modes] Cached modes of '{}' are stale, probing them again", this->mode_key);
+    modes = ModeTable();
+    cached = false;
+  }
+  if (!cached) {
+    this->probe_modes(&modes);
+    save_mode_table(this->mode_cache, this->mode_key, modes);
+  }
+  this->resolutions = modes.resolutions;
+  this->resolution_info.clear();
   std::for_each(this->resolutions.begin(), this->resolutions.end(), [&](auto& res) {
     this->resolution_info = fmt::format("{} {}x{}", this->resolution_info, res.first.width(), res.first.height());
   });
@@ -102,9 +112,6 @@ void FlyCapture2Driver::connect(CameraInfo const& cam_info) {
   // set_op_enum(node_map(), "TriggerMode", "Off");
   // set_op_enum(node_map(), "TriggerSelector", "AcquisitionStart");
 
-  ImageFormat imgf;
-  imgf.set_format(ImageFormats::JPEG);
-  this->set_image_format(imgf);
   // set higher resolution
   error = this->camera.SetGigEImageBinningSettings(1, 1);
   if (error != fc::PGRERROR_OK)
@@ -147,6 +154,77 @@ void FlyCapture2Driver::connect(CameraInfo const& cam_info) {
   // resolution.set_width(this->sensor_width);
   // resolution.set_height(this->sensor_height);
   // this->set_resolution(resolution);
+  return is::make_status(StatusCode::OK);
+}
+
+void FlyCapture2Driver::probe_modes(ModeTable* modes) {
+  for (auto i = 0; i < fc::NUM_MODES; ++i) {
+    bool is_available;
+    auto error = this->camera.QueryGigEImagingMode(static_cast<fc::Mode>(i), &is_available);
+    if (error != fc::PGRERROR_OK)
+      continue;
+    if (!is_available)
+      continue;
+    modes->available |= 1u << i;
+    error = this->camera.SetGigEImagingMode(static_cast<fc::Mode>(i));
+    if (error != fc::PGRERROR_OK)
+      continue;
+    fc::Format7Info f7info;
+    bool supported;
+    fc::Camera _camera;
+    this->camera.Disconnect();
+    _camera.Connect(this->uid);
+    error = _camera.GetFormat7Info(&f7info, &supported);
+    _camera.Disconnect();
+    this->camera.Connect(this->uid);
+    if (error != fc::PGRERROR_OK)
+      continue;
+    auto has_mono8 = f7info.pixelFormatBitField & fc::PIXEL_FORMAT_MONO8;
+    auto has_rgb8 = f7info.pixelFormatBitField & fc::PIXEL_FORMAT_RGB8;
+    if (!(has_mono8) || !(has_rgb8))
+      continue;
+    fc::GigEImageSettingsInfo info;
+    error = this->camera.GetGigEImageSettingsInfo(&info);
+    if (error != fc::PGRERROR_OK)
+      continue;
+    Resolution res;
+    res.set_width(info.maxWidth);
+    res.set_height(info.maxHeight);
+    modes->resolutions.push_back(std::make_pair(res, static_cast<fc::Mode>(i)));
+  }
+  auto pos = std::unique(modes->resolutions.begin(), modes->resolutions.end(), [](auto& lhs, auto& rhs) {
+    return google::protobuf::util::MessageDifferencer::Equivalent(lhs.first, rhs.first);
+  });
+  modes->resolutions.erase(pos, modes->resolutions.end());
+}
+
+// A cached table is checked on every connect against what the camera reports without switching
+// modes: the modes available, and the resolution of the mode it is in when listed in the table.
+bool FlyCapture2Driver::check_modes(ModeTable const& modes) {
+  uint32_t available = 0;
+  for (auto i = 0; i < fc::NUM_MODES; ++i) {
+    bool is_available;
+    auto error = this->camera.QueryGigEImagingMode(static_cast<fc::Mode>(i), &is_available);
+    if (error != fc::PGRERROR_OK)
+      return false;
+    if (is_available)
+      available |= 1u << i;
+  }
+  if (available != modes.available)
+    return false;
+
+  fc::Mode active;
+  auto error = this->camera.GetGigEImagingMode(&active);
+  if (error != fc::PGRERROR_OK)
+    return false;
+  fc::GigEImageSettingsInfo info;
+  error = this->camera.GetGigEImageSettingsInfo(&info);
+  if (error != fc::PGRERROR_OK)
+    return false;
+  return std::all_of(modes.resolutions.begin(), modes.resolutions.end(), [&](auto const& resolution) {
+    return resolution.second != active ||
+           (resolution.first.width() == info.maxWidth && resolution.first.height() == info.maxHeight);
+  });
 }
 
 void FlyCapture2Driver::start_capture() {
@@ -167,72 +245,69 @@ void FlyCapture2Driver::stop_capture() {
   }
 }
 
-Image FlyCapture2Driver::grab_image() {
+uint64_t FlyCapture2Driver::device_time_ns(fc::TimeStamp const& stamp, std::chrono::system_clock::time_point arrival) {
+  if (!this->cycle_time)
+    return static_cast<uint64_t>(stamp.seconds) * 1000000000 + static_cast<uint64_t>(stamp.microSeconds) * 1000;
+
+  // 128 seconds of 8000 cycles, each one split in 3072 ticks
+  constexpr int64_t period_ns = 128 * int64_t(1000000000);
+  auto cycle_ns = static_cast<int64_t>(stamp.cycleSeconds % 128) * 1000000000 +
+                  static_cast<int64_t>(stamp.cycleCount) * 125000 +
+                  static_cast<int64_t>(stamp.cycleOffset) * 125000 / 3072;
+  if (this->cycle_started) {
+    // periods that went by since the last frame, counted on the host clock so that frames more than a
+    // period apart are unwrapped as well, arrivals jitter far less than a period
+    auto host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(arrival - this->last_arrival).count();
+    auto wraps = std::llround(static_cast<double>(host_ns - (cycle_ns - this->last_cycle_ns)) / period_ns);
+    this->cycle_epoch_ns += std::max<int64_t>(wraps, 0) * period_ns;
+  }
+  this->cycle_started = true;
+  this->last_cycle_ns = cycle_ns;
+  this->last_arrival = arrival;
+  return this->cycle_epoch_ns + cycle_ns;
+}
+
+Status FlyCapture2Driver::grab_frame(Frame* frame) {
   fc::Image image;
   Defer clean_image([&] { image.ReleaseBuffer(); });
+  auto started = std::chrono::steady_clock::now();
   auto error = camera.RetrieveBuffer(&image);
+  auto arrival = std::chrono::system_clock::now();
+  this->counters->stages.record(Stage::ACQUIRE, started);
   if (error != fc::PGRERROR_OK) {
-    is::warn("[Grab Image] {}", error.GetDescription());
+    // the image was never filled, its timestamp would throw the clock off
+    auto why = fmt::format("[Grab Image] {}", error.GetDescription());
+    is::warn("{}", why);
+    return internal_error(StatusCode::INTERNAL_ERROR, why);
   }
-  this->timestamp = is::to_timestamp(std::chrono::system_clock::now());
   auto pixel_format = image.GetPixelFormat();
 
-  fc::Image buffer;
-  Defer clean_buffer([&] {
-    if (pixel_format == fc::PIXEL_FORMAT_BGR)
-      buffer.ReleaseBuffer();
-  });
-  cv::Mat frame;
   if (pixel_format == fc::PIXEL_FORMAT_MONO8) {
-    auto stride = image.GetDataSize() / image.GetRows();
-    frame = cv::Mat(image.GetRows(), image.GetCols(), CV_8UC1, image.GetData(), stride);
+    frame->format = PixelFormat::MONO8;
   } else if (pixel_format == fc::PIXEL_FORMAT_RGB8) {
-    error = image.Convert(fc::PIXEL_FORMAT_BGR, &buffer);
-    if (error != fc::PGRERROR_OK) {
-      is::warn("[Grab Image] {}", error.GetDescription());
-      return Image();
-    }
-    auto stride = buffer.GetDataSize() / buffer.GetRows();
-    frame = cv::Mat(buffer.GetRows(), buffer.GetCols(), CV_8UC3, buffer.GetData(), stride);
+    // handed over as is, the encoder takes either channel order
+    frame->format = PixelFormat::RGB8;
+  } else if (pixel_format == fc::PIXEL_FORMAT_BGR) {
+    frame->format = PixelFormat::BGR8;
   } else {
-    is::warn("[Grab Image] Bad image type");
-    return Image();
+    return internal_error(StatusCode::INTERNAL_ERROR, "[Grab Image] Bad image type");
   }
-
-  auto compression_parm = get_compression_parm();
-  auto format = fmt::format(".{}", ImageFormats_Name(image_format.format()));
-  std::vector<unsigned char> image_data;
-  cv::imencode(format, frame, image_data, compression_parm);
-  Image compressed;
-  auto compressed_data = compressed.mutable_data();
-  compressed_data->resize(image_data.size());
-  std::copy(image_data.begin(), image_data.end(), compressed_data->begin());
-  return compressed;
-}
-
-pb::Timestamp FlyCapture2Driver::last_timestamp() {
-  return this->timestamp;
-}
-
-Status FlyCapture2Driver::set_image_format(ImageFormat const& imgf) {
-  if (imgf.has_compression()) {
-    auto value = imgf.compression().value();
-    if (value < 0.0 || value > 1.0) {
-      auto why = fmt::format("Compression level equals to {} is out of range. Must be: [0.0,1.0]", value);
-      return internal_error(StatusCode::OUT_OF_RANGE, why);
-    }
-  }
-  this->image_format = imgf;
-  return is::make_status(StatusCode::OK);
-}
-
-Status FlyCapture2Driver::get_image_format(ImageFormat* imgf) {
-  *imgf = this->image_format;
+  auto device_ns = this->device_time_ns(image.GetTimeStamp(), arrival);
+  frame->timestamp = is::to_timestamp(this->clock.update(device_ns, arrival));
+  frame->width = image.GetCols();
+  frame->height = image.GetRows();
+  frame->stride = image.GetDataSize() / image.GetRows();
+  auto capacity = frame->data.capacity();
+  started = std::chrono::steady_clock::now();
+  frame->data.assign(image.GetData(), image.GetData() + image.GetDataSize());
+  this->counters->stages.record(Stage::CONVERT, started);
+  this->counters->allocations.track(capacity, frame->data);
+  this->counters->copies.add(frame->data.size());
   return is::make_status(StatusCode::OK);
 }
 
 Status FlyCapture2Driver::set_sampling_rate(pb::FloatValue const& rate) {
-  return set_property_abs(this->camera, fc::FRAME_RATE, rate.value());
+  return set_property_abs(this->camera, this->written, fc::FRAME_RATE, rate.value());
 }
 
 Status FlyCapture2Driver::get_sampling_rate(pb::FloatValue* rate) {
@@ -269,6 +344,7 @@ Status FlyCapture2Driver::set_color_space(ColorSpace const& color_space) {
     }
     auto cs_cam = pos->get<Camera>();
     settings.pixelFormat = cs_cam;
+    this->written.clear();
     return set_image_settings(this->camera, settings);
   };
   return control_capture(function, color_space);
@@ -314,6 +390,8 @@ Status FlyCapture2Driver::set_resolution(Resolution const& resolution) {
     is_assert_ok(get_image_settings(this->camera, &settings));
     auto pixel_format = settings.pixelFormat;
     auto mode = static_cast<fc::Mode>(pos->second);
+    // a new mode or image size moves the frame rate and shutter limits, the camera may clamp them
+    this->written.clear();
     error = this->camera.SetGigEImagingMode(mode);
     if (error != fc::PGRERROR_OK) {
       auto why = fmt::format("[SetResolution] {}", error.GetDescription());
@@ -403,12 +481,12 @@ Status FlyCapture2Driver::get_delay(pb::FloatValue* delay) {
 
 Status FlyCapture2Driver::set_shutter(CameraSetting const& shutter) {
   if (shutter.automatic())
-    is_assert_ok(set_property_auto(this->camera, fc::SHUTTER));
+    is_assert_ok(set_property_auto(this->camera, this->written, fc::SHUTTER));
   else {
     float frame_rate = 0.0f;
     is_assert_ok(get_property_abs(this->camera, fc::FRAME_RATE, &frame_rate));
     auto period_ms = 1000.0 / frame_rate;
-    is_assert_ok(set_property_abs(this->camera, fc::SHUTTER, period_ms * shutter.ratio()));
+    is_assert_ok(set_property_abs(this->camera, this->written, fc::SHUTTER, period_ms * shutter.ratio()));
   }
   return is::make_status(StatusCode::OK);
 }
@@ -624,17 +702,22 @@ Status FlyCapture2Driver::get_iris(CameraSetting*) {
 }
 
 Status FlyCapture2Driver::set_packet_delay(int const& packet_delay) {
+  // known values skip the acquisition restart too, not only the write
+  if (this->written.holds(get_gige_property_name(fc::PACKET_DELAY), static_cast<int64_t>(packet_delay)))
+    return is::make_status(StatusCode::OK);
   auto function = [&](int const& pd) -> Status {
-    return set_gige_property(this->camera, fc::PACKET_DELAY, packet_delay);
+    return set_gige_property(this->camera, this->written, fc::PACKET_DELAY, packet_delay);
   };
-  return control_capture(function, packet_delay);
+  return control_capture(fc::PACKET_DELAY, function, packet_delay);
 }
 
 Status FlyCapture2Driver::set_packet_size(int const& packet_size) {
+  if (this->written.holds(get_gige_property_name(fc::PACKET_SIZE), static_cast<int64_t>(packet_size)))
+    return is::make_status(StatusCode::OK);
   auto function = [&](int const& ps) -> Status {
-    return set_gige_property(this->camera, fc::PACKET_SIZE, packet_size);
+    return set_gige_property(this->camera, this->written, fc::PACKET_SIZE, packet_size);
   };
-  return control_capture(function, packet_size);
+  return control_capture(fc::PACKET_SIZE, function, packet_size);
 }
 
 Status FlyCapture2Driver::reverse_x(bool) {
@@ -645,26 +728,5 @@ Status FlyCapture2Driver::reverse_y(bool) {
   return internal_error(StatusCode::UNIMPLEMENTED, "\'Reverse Y\' property not implemented for this camera.");
 }
 
-std::vector<int> FlyCapture2Driver::get_compression_parm() {
-  std::vector<int> parm;
-  if (this->image_format.has_compression()) {
-    auto value = this->image_format.compression().value();
-    if (this->image_format.format() == ImageFormats::PNG) {
-      parm.push_back(cv::IMWRITE_PNG_COMPRESSION);
-      int level = value * (9 - 0) + 0;
-      parm.push_back(level);
-    } else if (this->image_format.format() == ImageFormats::JPEG) {
-      parm.push_back(cv::IMWRITE_JPEG_QUALITY);
-      int level = value * (100 - 0) + 0;
-      parm.push_back(level);
-    } else if (this->image_format.format() == ImageFormats::WebP) {
-      parm.push_back(cv::IMWRITE_WEBP_QUALITY);
-      int level = value * (100 - 1) + 1;
-      parm.push_back(level);
-    }
-  }
-  return parm;
-}
-
 }  // namespace camera
 }  // namespace is
\ No newline at end of file
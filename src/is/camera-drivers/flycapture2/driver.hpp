@@ -9,6 +9,11 @@
 #include <string>
 #include <vector>
 #include "is/camera-drivers/interface/camera-driver.hpp"
+#include "is/camera-drivers/utils/clock-estimator.hpp"
+#include "is/camera-drivers/utils/latency-histogram.hpp"
+#include "is/camera-drivers/utils/write-cache.hpp"
+#include "internal/modes.hpp"
+#include "internal/nodes.hpp"
 #include "FlyCapture2.h"
 
 #define is_assert_ok(failable)                     \
@@ -26,24 +31,29 @@ using namespace boost::bimaps;
 
 class FlyCapture2Driver : public CameraDriver {
  public:
-  FlyCapture2Driver();
+  // 'mode_cache' is the file where probed imaging modes are kept between connects, empty disables it
+  explicit FlyCapture2Driver(std::string const& mode_cache = "");
   ~FlyCapture2Driver();
 
   static std::vector<CameraInfo> find_cameras();
-  void connect(CameraInfo const& cam_info);
+  Status connect(CameraInfo const& cam_info) override;
   void start_capture() override;
   void stop_capture() override;
-  Image grab_image() override;
-  pb::Timestamp last_timestamp() override;
+  Status grab_frame(Frame* frame) override;
+  double timestamp_residual_ms() const override { return this->clock.residual_ms(); }
+  void set_counters(FrameCounters* counters) override { this->counters = counters; }
+  uint64_t saved_writes() const override { return this->written.saved(); }
 
-  Status set_image_format(ImageFormat const& imgf) override;
-  Status get_image_format(ImageFormat* imgf) override;
   Status set_sampling_rate(pb::FloatValue const& rate) override;
   Status get_sampling_rate(pb::FloatValue* rate) override;
   Status set_color_space(ColorSpace const& color_space) override;
   Status get_color_space(ColorSpace* color_space) override;
   Status set_resolution(Resolution const& resolution) override;
   Status get_resolution(Resolution* resolution) override;
+  // the image format is only written with acquisition stopped, and regions of interest are not supported
+  bool requires_restart(Resolution const&) override { return this->is_capturing; }
+  bool requires_restart(ColorSpace const&) override { return this->is_capturing; }
+  bool requires_restart(BoundingPoly const&) override { return false; }
   Status set_region_of_interest(BoundingPoly const& roi) override;
   Status get_region_of_interest(BoundingPoly* roi) override;
   Status set_delay(pb::FloatValue const& delay) override;
@@ -92,13 +102,24 @@ class FlyCapture2Driver : public CameraDriver {
   int sensor_width, sensor_height, max_binning_h, max_binning_v, step_h, step_v;
   std::vector<std::pair<Resolution, fc::Mode>> resolutions;
   std::string resolution_info;
+  std::string mode_cache, mode_key;
 
   bool is_capturing;
-  ImageFormat image_format;
-  is::pb::Timestamp timestamp;
+  ClockEstimator clock;
+  // device time is built from the cycle timer embedded in the frames, unwrapped across its 128 s period
+  bool cycle_time;
+  bool cycle_started;
+  int64_t cycle_epoch_ns, last_cycle_ns;
+  std::chrono::system_clock::time_point last_arrival;
+  FrameCounters* counters;
+  WriteCache written;
 
   ColorSpaceBimap color_space_map;
 
+  void probe_modes(ModeTable* modes);
+  uint64_t device_time_ns(fc::TimeStamp const& stamp, std::chrono::system_clock::time_point arrival);
+  bool check_modes(ModeTable const& modes);
+
   template <typename F, typename P>
   Status control_capture(F&& function, P const& value) {
     auto keep_capturing = this->is_capturing;
@@ -110,6 +131,14 @@ class FlyCapture2Driver : public CameraDriver {
     return status;
   }
 
+  // Only stops acquisition when the GigE property can't be written while streaming.
+  template <typename F, typename P>
+  Status control_capture(fc::GigEPropertyType type, F&& function, P const& value) {
+    if (this->is_capturing && is_gige_property_writable(this->camera, type))
+      return function(value);
+    return this->control_capture(function, value);
+  }
+
   struct Defer {
     std::function<void()> on_exit;
     Defer(std::function<void()>&& f) noexcept : on_exit(std::move(f)) {}
@@ -119,7 +148,6 @@ class FlyCapture2Driver : public CameraDriver {
     ~Defer() { on_exit(); }
   };
 
-  std::vector<int> get_compression_parm();
 };
 
 }  // namespace camera
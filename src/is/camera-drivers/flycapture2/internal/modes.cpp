@@ -0,0 +1,103 @@
+#include "modes.hpp"
+#include <google/protobuf/util/json_util.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <is/wire/core/logger.hpp>
+#include <sstream>
+#include "modes.pb.h"
+
+namespace is {
+namespace camera {
+
+namespace {
+
+bool read_cache(std::string const& path, ModeCache* cache) {
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  auto status = google::protobuf::util::JsonStringToMessage(buffer.str(), cache);
+  if (!status.ok()) {
+    is::warn("[ModeTable] Ignoring '{}': {}", path, status.ToString());
+    cache->Clear();
+    return false;
+  }
+  return true;
+}
+
+// Written aside and renamed, so gateways sharing the file never read a partial one. The temporary
+// file is named after the process, so they don't write over each other's either.
+void write_cache(std::string const& path, ModeCache const& cache) {
+  std::string json;
+  google::protobuf::util::JsonPrintOptions options;
+  options.add_whitespace = true;
+  google::protobuf::util::MessageToJsonString(cache, &json, options);
+  auto temporary = fmt::format("{}.{}.tmp", path, getpid());
+  {
+    std::ofstream file(temporary, std::ios::trunc);
+    if (!(file << json)) {
+      is::warn("[ModeTable] Failed to write '{}'", temporary);
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    is::warn("[ModeTable] Failed to replace '{}'", path);
+    std::remove(temporary.c_str());
+  }
+}
+
+}  // namespace
+
+std::string make_mode_key(fc::CameraInfo const& info) {
+  return fmt::format("{}/{}", info.modelName, info.firmwareVersion);
+}
+
+bool load_mode_table(std::string const& path, std::string const& key, ModeTable* table) {
+  if (path.empty())
+    return false;
+  ModeCache cache;
+  if (!read_cache(path, &cache))
+    return false;
+  auto camera = cache.cameras().find(key);
+  if (camera == cache.cameras().end())
+    return false;
+
+  ModeTable loaded;
+  loaded.available = camera->second.available();
+  for (auto const& mode : camera->second.resolutions()) {
+    if (mode.mode() >= static_cast<uint32_t>(fc::NUM_MODES))
+      return false;
+    is::vision::Resolution resolution;
+    resolution.set_width(mode.width());
+    resolution.set_height(mode.height());
+    loaded.resolutions.emplace_back(resolution, static_cast<fc::Mode>(mode.mode()));
+  }
+  if (loaded.resolutions.empty())
+    return false;
+  *table = std::move(loaded);
+  return true;
+}
+
+void save_mode_table(std::string const& path, std::string const& key, ModeTable const& table) {
+  if (path.empty())
+    return;
+  CameraModes modes;
+  modes.set_available(table.available);
+  for (auto& resolution : table.resolutions) {
+    auto mode = modes.add_resolutions();
+    mode->set_mode(static_cast<uint32_t>(resolution.second));
+    mode->set_width(resolution.first.width());
+    mode->set_height(resolution.first.height());
+  }
+  // read right before writing, so what other gateways saved meanwhile is kept
+  ModeCache cache;
+  read_cache(path, &cache);
+  (*cache.mutable_cameras())[key] = modes;
+  write_cache(path, cache);
+}
+
+}  // namespace camera
+}  // namespace is
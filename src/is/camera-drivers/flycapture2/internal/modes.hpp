@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <is/msgs/camera.pb.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "FlyCapture2.h"
+
+namespace is {
+namespace camera {
+
+namespace fc = FlyCapture2;
+
+// Imaging modes of a camera model and firmware. Probing them takes seconds, so they are kept in a
+// JSON file shared by every camera, see ModeCache in modes.proto.
+struct ModeTable {
+  uint32_t available = 0;  // bit i is set when fc::Mode i is available
+  std::vector<std::pair<is::vision::Resolution, fc::Mode>> resolutions;
+};
+
+std::string make_mode_key(fc::CameraInfo const& info);
+bool load_mode_table(std::string const& path, std::string const& key, ModeTable* table);
+// Merged into whatever the file holds when written, so gateways sharing it don't drop each other's modes.
+void save_mode_table(std::string const& path, std::string const& key, ModeTable const& table);
+
+}  // namespace camera
+}  // namespace is
@@ -5,7 +5,10 @@ namespace camera {
 
 using namespace is::common;
 
-Status set_gige_property(fc::GigECamera& camera, fc::GigEPropertyType type, int value) {
+Status set_gige_property(fc::GigECamera& camera, WriteCache& written, fc::GigEPropertyType type, int value) {
+  auto name = get_gige_property_name(type);
+  if (written.holds(name, static_cast<int64_t>(value)))
+    return is::make_status(StatusCode::OK);
   fc::GigEProperty property;
   property.propType = type;
   property.value = value;
@@ -16,10 +19,22 @@ Status set_gige_property(fc::GigECamera& camera, fc::GigEPropertyType type, int
     // return internal_error(StatusCode::INTERNAL_ERROR, why);
     return is::make_status(StatusCode::OK);
   }
+  written.remember(name, static_cast<int64_t>(value));
   return is::make_status(StatusCode::OK);
 }
 
-Status set_property_auto(fc::GigECamera& camera, fc::PropertyType type) {
+bool is_gige_property_writable(fc::GigECamera& camera, fc::GigEPropertyType type) {
+  fc::GigEProperty property;
+  property.propType = type;
+  auto error = camera.GetGigEProperty(&property);
+  return error == fc::PGRERROR_OK && property.isWritable;
+}
+
+Status set_property_auto(fc::GigECamera& camera, WriteCache& written, fc::PropertyType type) {
+  // the camera moves the value on its own while in auto, so nothing is known about it from now on
+  written.forget(get_property_name(type));
+  if (type == fc::FRAME_RATE)
+    written.forget(get_property_name(fc::SHUTTER));
   fc::Property property(type);
   property.onOff = true;
   property.autoManualMode = true;
@@ -37,7 +52,8 @@ Status get_property_auto(fc::GigECamera& camera, fc::PropertyType type, bool* is
   return is::make_status(StatusCode::OK);
 }
 
-Status set_property_abs(fc::GigECamera& camera, fc::PropertyType type, float value, bool is_ratio) {
+Status set_property_abs(fc::GigECamera& camera, WriteCache& written, fc::PropertyType type, float value,
+                        bool is_ratio) {
   fc::PropertyInfo info(type);
   auto error = camera.GetPropertyInfo(&info);
   fc_assert_ok(error, type);
@@ -51,6 +67,9 @@ Status set_property_abs(fc::GigECamera& camera, fc::PropertyType type, float val
                            value, info.absMin, info.absMax);
     return internal_error(StatusCode::OUT_OF_RANGE, msg);
   }
+  auto name = get_property_name(type);
+  if (written.holds(name, static_cast<double>(value)))
+    return is::make_status(StatusCode::OK);
 
   fc::Property property(type);
   property.absValue = value;
@@ -60,6 +79,10 @@ Status set_property_abs(fc::GigECamera& camera, fc::PropertyType type, float val
 
   error = camera.SetProperty(&property);
   fc_assert_ok(error, type);
+  written.remember(name, static_cast<double>(value));
+  // the shutter is bounded by the frame period, the camera may have shortened it
+  if (type == fc::FRAME_RATE)
+    written.forget(get_property_name(fc::SHUTTER));
   return is::make_status(StatusCode::OK);
 }
 
@@ -114,5 +137,13 @@ std::string get_property_name(fc::PropertyType type) {
   }
 }
 
+std::string get_gige_property_name(fc::GigEPropertyType type) {
+  switch (type) {
+  case fc::PACKET_SIZE: return "Packet Size";
+  case fc::PACKET_DELAY: return "Packet Delay";
+  default: return "Unknown GigE Property";
+  }
+}
+
 }  // namespace camera
 }  // namespace is
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <string>
 #include "FlyCapture2.h"
 #include "is/camera-drivers/utils/utils.hpp"
+#include "is/camera-drivers/utils/write-cache.hpp"
 
 #define fc_assert_ok(error, type)                                                         \
   do {                                                                                    \
@@ -22,14 +23,19 @@ namespace camera {
 using namespace is::common;
 namespace fc = FlyCapture2;
 
-Status set_gige_property(fc::GigECamera& camera, fc::GigEPropertyType type, int value);
-Status set_property_auto(fc::GigECamera& camera, fc::PropertyType type);
+// Setters skip the write when 'written' knows the camera holds the value, see WriteCache. Properties
+// in auto are never known, switching one to auto forgets it.
+Status set_gige_property(fc::GigECamera& camera, WriteCache& written, fc::GigEPropertyType type, int value);
+Status set_property_auto(fc::GigECamera& camera, WriteCache& written, fc::PropertyType type);
+bool is_gige_property_writable(fc::GigECamera& camera, fc::GigEPropertyType type);
 Status get_property_auto(fc::GigECamera& camera, fc::PropertyType type, bool* is_auto);
-Status set_property_abs(fc::GigECamera& camera, fc::PropertyType type, float value, bool is_ratio = false);
+Status set_property_abs(fc::GigECamera& camera, WriteCache& written, fc::PropertyType type, float value,
+                        bool is_ratio = false);
 Status get_property_abs(fc::GigECamera& camera, fc::PropertyType type, float* value, bool is_ratio = false);
 Status set_image_settings(fc::GigECamera& camera, fc::GigEImageSettings const& settings);
 Status get_image_settings(fc::GigECamera& camera, fc::GigEImageSettings* settings);
 std::string get_property_name(fc::PropertyType type);
+std::string get_gige_property_name(fc::GigEPropertyType type);
 
 }  // namespace camera
 }  // namespace is
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <is/msgs/common.pb.h>
 #include <is/wire/core/status.hpp>
 #include <is/msgs/image.pb.h>
+#include <vector>
 #include "camera-info.pb.h"
 
 namespace is {
@@ -20,14 +21,32 @@ namespace camera {
 using namespace is::common;
 using namespace is::vision;
 
+struct FrameCounters;  // see utils/utils.hpp
+
+enum class PixelFormat { MONO8, RGB8, BGR8 };
+
+// Uncompressed frame as delivered by the camera, before any encoding.
+struct Frame {
+  std::vector<unsigned char> data;
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+  PixelFormat format = PixelFormat::MONO8;
+  pb::Timestamp timestamp;
+};
+
 struct CameraDriver {
   virtual ~CameraDriver() = default;
 
   // // Image Settings
   virtual Status set_resolution(Resolution const&) = 0;
-  virtual Status set_image_format(ImageFormat const&) = 0;
   virtual Status set_color_space(ColorSpace const&) = 0;
   virtual Status set_region_of_interest(BoundingPoly const&) = 0;
+  // Whether the matching set_* stops acquisition to write the value, which it does only while capturing
+  // and when the camera does not accept the write live
+  virtual bool requires_restart(Resolution const&) = 0;
+  virtual bool requires_restart(ColorSpace const&) = 0;
+  virtual bool requires_restart(BoundingPoly const&) = 0;
   // // Sampling Settings
   virtual Status set_sampling_rate(pb::FloatValue const&) = 0;
   virtual Status set_delay(pb::FloatValue const&) = 0;
@@ -48,7 +67,6 @@ struct CameraDriver {
 
   // // Image Settings
   virtual Status get_resolution(Resolution* resolution) = 0;
-  virtual Status get_image_format(ImageFormat* resolution) = 0;
   virtual Status get_color_space(ColorSpace* resolution) = 0;
   virtual Status get_region_of_interest(BoundingPoly* resolution) = 0;
   // // Sampling Settings
@@ -73,9 +91,22 @@ struct CameraDriver {
   virtual Status set_packet_size(int const& packet_size) = 0;
   virtual Status reverse_x(bool enable) = 0;
   virtual Status reverse_y(bool enable) = 0;
-  virtual pb::Timestamp last_timestamp() = 0;
-  virtual Image grab_image() = 0;
-  virtual void connect(CameraInfo const& cam_info) = 0;
+  // Raw acquisition only, compression is left to the caller (see encoder/encoder.hpp). Frames are
+  // stamped by the camera clock mapped to system time, see utils/clock-estimator.hpp
+  virtual Status grab_frame(Frame* frame) = 0;
+  // Where grab_frame accounts its latencies, copies and allocations, set before grabbing.
+  virtual void set_counters(FrameCounters* counters) = 0;
+  virtual double timestamp_residual_ms() const = 0;
+  // Writes skipped because the camera was known to hold the value already. Drivers know it differently:
+  // Spinnaker reads the current value of the node back, once per write. FlyCapture2 compares with the
+  // last value it wrote (see utils/write-cache.hpp), so it never skips writes to settings that were
+  // under automatic control since, and misses changes made to the camera by other processes.
+  virtual uint64_t saved_writes() const = 0;
+  // Connects to the camera of 'cam_info.serial_number()', only 'ethernet().ip_address()', 'serial_number()' and
+  // 'model_name()' are expected to be set. FlyCapture2 reaches it directly, Spinnaker still has to discover
+  // cameras the first time a process connects to one. Fails with FAILED_PRECONDITION when the camera is no
+  // longer at 'ethernet().ip_address()', e.g. after being swapped or re-addressed.
+  virtual Status connect(CameraInfo const& cam_info) = 0;
   virtual void start_capture() = 0;
   virtual void stop_capture() = 0;
 };  // CameraDriver
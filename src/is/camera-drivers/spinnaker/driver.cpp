@@ -1,8 +1,5 @@
 #include "driver.hpp"
 #include <google/protobuf/util/message_differencer.h>
-#include <opencv2/core.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/imgproc.hpp>
 #include "internal/info.hpp"
 #include "internal/nodes.hpp"
 
@@ -15,7 +12,17 @@ using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
 }  // namespace spn
 
-SpinnakerDriver::SpinnakerDriver() : is_capturing(false) {
+namespace {
+
+// nodes written by set_resolution and set_color_space, streaming goes on only when all of them are writable
+std::vector<std::string> const resolution_nodes{"OffsetX", "OffsetY", "BinningHorizontal", "BinningVertical",
+                                                "Width",   "Height"};
+std::vector<std::string> const color_space_nodes{"PixelFormat"};
+
+}  // namespace
+
+SpinnakerDriver::SpinnakerDriver(StreamSettings const& stream)
+    : stream(stream), is_capturing(false), counters(nullptr) {
   this->color_space_map.insert(ColorSpaceBimap::value_type(ColorSpaces::GRAY, "Mono8"));
   this->color_space_map.insert(ColorSpaceBimap::value_type(ColorSpaces::RGB, "BGR8"));
 }
@@ -29,26 +36,27 @@ std::vector<CameraInfo> SpinnakerDriver::find_cameras() {
     CameraInfo info;
     auto cam = cam_list.GetByIndex(i);
     auto eth = info.mutable_ethernet();
+    NodeCache device_nodes(cam->GetTLDeviceNodeMap());
 
     int64_t int_value = 0;
-    if (get_op_int(cam->GetTLDeviceNodeMap(), "GevDeviceIPAddress", &int_value).code() != StatusCode::OK)
+    if (get_op_int(device_nodes, "GevDeviceIPAddress", &int_value).code() != StatusCode::OK)
       continue;
     eth->set_ip_address(make_ip_address(int_value));
-    if (get_op_int(cam->GetTLDeviceNodeMap(), "GevDeviceSubnetMask", &int_value).code() != StatusCode::OK)
+    if (get_op_int(device_nodes, "GevDeviceSubnetMask", &int_value).code() != StatusCode::OK)
       continue;
     eth->set_subnet_mask(make_subnet_mask(int_value));
-    if (get_op_int(cam->GetTLDeviceNodeMap(), "GevDeviceMACAddress", &int_value).code() != StatusCode::OK)
+    if (get_op_int(device_nodes, "GevDeviceMACAddress", &int_value).code() != StatusCode::OK)
       continue;
     eth->set_mac_address(make_mac_address(int_value));
-    if (get_op_int(cam->GetTLDeviceNodeMap(), "DeviceLinkSpeed", &int_value).code() != StatusCode::OK)
+    if (get_op_int(device_nodes, "DeviceLinkSpeed", &int_value).code() != StatusCode::OK)
       continue;
     info.set_link_speed(int_value);
 
     std::string str_value = "";
-    if (get_op_str(cam->GetTLDeviceNodeMap(), "DeviceModelName", &str_value).code() != StatusCode::OK)
+    if (get_op_str(device_nodes, "DeviceModelName", &str_value).code() != StatusCode::OK)
       continue;
     info.set_model_name(str_value);
-    if (get_op_str(cam->GetTLDeviceNodeMap(), "DeviceSerialNumber", &str_value).code() != StatusCode::OK)
+    if (get_op_str(device_nodes, "DeviceSerialNumber", &str_value).code() != StatusCode::OK)
       continue;
     info.set_serial_number(str_value);
     cam_infos.push_back(info);
@@ -56,13 +64,39 @@ std::vector<CameraInfo> SpinnakerDriver::find_cameras() {
   return cam_infos;
 }
 
-void SpinnakerDriver::connect(CameraInfo const& cam_info) {
+Status SpinnakerDriver::connect(CameraInfo const& cam_info) {
   try {
     this->cam_system = spn::System::GetInstance();
-    this->cam_list = this->cam_system->GetCameras();
+    // the list kept by the system holds whatever it discovered earlier in this process, only when the
+    // camera is not there the SDK has to go through the interfaces and discover cameras again
+    this->cam_list = this->cam_system->GetCameras(false, false);
     this->cam = this->cam_list.GetBySerial(cam_info.serial_number());
+    if (!this->cam.IsValid()) {
+      is::info("[Camera Initialize] Camera {} not discovered yet, discovering cameras", cam_info.serial_number());
+      this->cam_list = this->cam_system->GetCameras();
+      this->cam = this->cam_list.GetBySerial(cam_info.serial_number());
+    }
+    if (!this->cam.IsValid()) {
+      auto why = fmt::format("[Camera Initialize] No camera with serial number {}", cam_info.serial_number());
+      return internal_error(StatusCode::NOT_FOUND, why);
+    }
+    auto const& wanted_ip = cam_info.ethernet().ip_address();
+    NodeCache device_nodes(this->cam->GetTLDeviceNodeMap());
+    int64_t ip = 0;
+    if (!wanted_ip.empty() && get_op_int(device_nodes, "GevDeviceIPAddress", &ip).code() == StatusCode::OK &&
+        make_ip_address(ip) != wanted_ip) {
+      auto why = fmt::format("[Camera Initialize] Camera {} is at {}, not {}", cam_info.serial_number(),
+                             make_ip_address(ip), wanted_ip);
+      this->cam = nullptr;
+      return internal_error(StatusCode::FAILED_PRECONDITION, why);
+    }
     this->cam->Init();
-  } catch (Spinnaker::Exception& e) { is::critical("[{}] {}", "Camera Initialize", e.what()); }
+    this->nodes.reset(&this->cam->GetNodeMap());
+    this->stream_nodes.reset(&this->cam->GetTLStreamNodeMap());
+  } catch (Spinnaker::Exception& e) {
+    return internal_error(StatusCode::UNAVAILABLE, fmt::format("[Camera Initialize] {}", e.what()));
+  }
+  this->apply_stream_settings();
 
   // Initial configuration
   this->set_packet_size(1400);
@@ -72,9 +106,6 @@ void SpinnakerDriver::connect(CameraInfo const& cam_info) {
   set_op_enum(node_map(), "TriggerMode", "Off");
   set_op_enum(node_map(), "TriggerSelector", "AcquisitionStart");
 
-  ImageFormat imgf;
-  imgf.set_format(ImageFormats::JPEG);
-  this->set_image_format(imgf);
 
   pb::FloatValue sr;
   sr.set_value(1.0);
@@ -114,6 +145,7 @@ void SpinnakerDriver::connect(CameraInfo const& cam_info) {
   resolution.set_width(this->sensor_width);
   resolution.set_height(this->sensor_height);
   this->set_resolution(resolution);
+  return is::make_status(StatusCode::OK);
 }
 
 void SpinnakerDriver::start_capture() {
@@ -130,64 +162,48 @@ void SpinnakerDriver::stop_capture() {
   } catch (Spinnaker::Exception& e) { is::warn("[{}] {}", "Stop Capture", e.what()); }
 }
 
-Image SpinnakerDriver::grab_image() {
+Status SpinnakerDriver::grab_frame(Frame* frame) {
   spn::ImagePtr image;
+  auto started = std::chrono::steady_clock::now();
   try {
     image = this->cam->GetNextImage(3000);
   } catch (...) {
     is::error("[Grab Image] Timeouted");
     this->stop_capture();
     this->start_capture();
-    return Image();
+    return is::make_status(StatusCode::DEADLINE_EXCEEDED, "[Grab Image] Timeouted");
   }
 
+  auto arrival = std::chrono::system_clock::now();
+  this->counters->stages.record(Stage::ACQUIRE, started);
   if (image->IsIncomplete())
     is::warn("[Grab Image] Image incomplete");
-  this->timestamp = is::to_timestamp(std::chrono::system_clock::now());
 
-  auto rows = image->GetHeight();
-  auto cols = image->GetWidth();
-  auto data = image->GetData();
-  auto stride = image->GetStride();
   auto pixel_format = image->GetPixelFormat();
-  cv::Mat frame;
   if (pixel_format == spn::PixelFormatEnums::PixelFormat_Mono8)
-    frame = cv::Mat(rows, cols, CV_8UC1, static_cast<unsigned char*>(data), stride);
+    frame->format = PixelFormat::MONO8;
+  else if (pixel_format == spn::PixelFormatEnums::PixelFormat_RGB8)
+    frame->format = PixelFormat::RGB8;
   else if (pixel_format == spn::PixelFormatEnums::PixelFormat_BGR8)
-    frame = cv::Mat(rows, cols, CV_8UC3, static_cast<unsigned char*>(data), stride);
+    frame->format = PixelFormat::BGR8;
   else {
-    // throw std::runtime_error("[Grab Image] Bad image type");
-    is::error("[Grab Image] Bad image type");
-    return Image();
+    image->Release();
+    return internal_error(StatusCode::INTERNAL_ERROR, "[Grab Image] Bad image type");
   }
-  auto compression_parm = get_compression_parm();
-  std::vector<unsigned char> image_data;
-  cv::imencode(fmt::format(".{}", ImageFormats_Name(image_format.format())), frame, image_data, compression_parm);
-  Image compressed;
-  auto compressed_data = compressed.mutable_data();
-  compressed_data->resize(image_data.size());
-  std::copy(image_data.begin(), image_data.end(), compressed_data->begin());
-  return compressed;
-}
-
-pb::Timestamp SpinnakerDriver::last_timestamp() {
-  return this->timestamp;
-}
-
-Status SpinnakerDriver::set_image_format(ImageFormat const& imgf) {
-  if (imgf.has_compression()) {
-    auto value = imgf.compression().value();
-    if (value < 0.0 || value > 1.0) {
-      auto why = fmt::format("Compression level equals to {} is out of range. Must be: [0.0,1.0]", value);
-      return internal_error(StatusCode::OUT_OF_RANGE, why);
-    }
-  }
-  this->image_format = imgf;
-  return is::make_status(StatusCode::OK);
-}
-
-Status SpinnakerDriver::get_image_format(ImageFormat* imgf) {
-  *imgf = this->image_format;
+  // only frames handed over feed the clock estimate
+  frame->timestamp = is::to_timestamp(this->clock.update(image->GetTimeStamp(), arrival));
+  frame->width = image->GetWidth();
+  frame->height = image->GetHeight();
+  frame->stride = image->GetStride();
+  // copy out of the SDK buffer so it can be handed back before the frame is encoded
+  auto data = static_cast<unsigned char*>(image->GetData());
+  auto capacity = frame->data.capacity();
+  started = std::chrono::steady_clock::now();
+  frame->data.assign(data, data + frame->stride * frame->height);
+  this->counters->stages.record(Stage::CONVERT, started);
+  this->counters->allocations.track(capacity, frame->data);
+  this->counters->copies.add(frame->data.size());
+  image->Release();
   return is::make_status(StatusCode::OK);
 }
 
@@ -227,7 +243,7 @@ Status SpinnakerDriver::set_color_space(ColorSpace const& color_space) {
     is_assert_ok(set_op_enum(node_map(), "PixelFormat", cs_cam));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, color_space);
+  return control_capture(color_space_nodes, function, color_space);
 }
 
 Status SpinnakerDriver::get_color_space(ColorSpace* color_space) {
@@ -272,7 +288,7 @@ Status SpinnakerDriver::set_resolution(Resolution const& resolution) {
     is_assert_ok(set_op_int(node_map(), "Height", height));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, resolution);
+  return control_capture(resolution_nodes, function, resolution);
 }
 
 Status SpinnakerDriver::get_resolution(Resolution* resolution) {
@@ -291,16 +307,17 @@ Status SpinnakerDriver::set_region_of_interest(BoundingPoly const& roi) {
   if (n_verticies > 2)
     return internal_error(StatusCode::UNIMPLEMENTED, "Funtionality implemented just for BoundingPoly with 2 vertices");
 
-  auto function = [&](BoundingPoly const& r) -> Status {
-    auto top_left = r.vertices(0);
-    auto bottom_right = r.vertices(1);
-    int64_t width = bottom_right.x() - top_left.x();
-    int64_t height = bottom_right.y() - top_left.y();
-    int64_t max_width = 0, max_height = 0;
-    is_assert_ok(get_op_int(node_map(), "WidthMax", &max_width));
-    is_assert_ok(get_op_int(node_map(), "HeightMax", &max_height));
-    is_assert_ok(set_op_int(node_map(), "Width", std::min(width, max_width)));
-    is_assert_ok(set_op_int(node_map(), "Height", std::min(height, max_height)));
+  int64_t width = 0, height = 0;
+  std::vector<std::string> names;
+  is_assert_ok(this->region_nodes(roi, &width, &height, &names));
+  auto resize = names.size() > 2;
+  auto top_left = roi.vertices(0);
+
+  auto function = [&](BoundingPoly const&) -> Status {
+    if (resize) {
+      is_assert_ok(set_op_int(node_map(), "Width", width));
+      is_assert_ok(set_op_int(node_map(), "Height", height));
+    }
     OpRange<int64_t> offset_x, offset_y;
     is_assert_ok(minmax_op_int(node_map(), "OffsetX", &offset_x));
     is_assert_ok(minmax_op_int(node_map(), "OffsetY", &offset_y));
@@ -308,7 +325,52 @@ Status SpinnakerDriver::set_region_of_interest(BoundingPoly const& roi) {
     is_assert_ok(set_op_int(node_map(), "OffsetY", std::min(static_cast<int64_t>(top_left.y()), offset_y.max)));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, roi);
+  return control_capture(names, function, roi);
+}
+
+// panning keeps the size, so only the offsets are written and acquisition may go on
+Status SpinnakerDriver::region_nodes(BoundingPoly const& roi, int64_t* width, int64_t* height,
+                                     std::vector<std::string>* names) {
+  auto top_left = roi.vertices(0);
+  auto bottom_right = roi.vertices(1);
+  int64_t max_width = 0, max_height = 0;
+  is_assert_ok(get_op_int(node_map(), "WidthMax", &max_width));
+  is_assert_ok(get_op_int(node_map(), "HeightMax", &max_height));
+  *width = std::min(static_cast<int64_t>(bottom_right.x() - top_left.x()), max_width);
+  *height = std::min(static_cast<int64_t>(bottom_right.y() - top_left.y()), max_height);
+  int64_t current_width = 0, current_height = 0;
+  *names = {"OffsetX", "OffsetY"};
+  auto resize = get_op_int(node_map(), "Width", &current_width).code() != StatusCode::OK ||
+                get_op_int(node_map(), "Height", &current_height).code() != StatusCode::OK ||
+                current_width != *width || current_height != *height;
+  if (resize) {
+    names->push_back("Width");
+    names->push_back("Height");
+  }
+  return is::make_status(StatusCode::OK);
+}
+
+bool SpinnakerDriver::writable(std::vector<std::string> const& names) {
+  return std::all_of(names.begin(), names.end(),
+                     [this](auto& name) { return Spinnaker::GenApi::IsWritable(this->nodes.node(name)); });
+}
+
+bool SpinnakerDriver::requires_restart(Resolution const&) {
+  return this->is_capturing && !this->writable(resolution_nodes);
+}
+
+bool SpinnakerDriver::requires_restart(ColorSpace const&) {
+  return this->is_capturing && !this->writable(color_space_nodes);
+}
+
+bool SpinnakerDriver::requires_restart(BoundingPoly const& roi) {
+  if (!this->is_capturing || roi.vertices_size() != 2)
+    return false;
+  int64_t width = 0, height = 0;
+  std::vector<std::string> names;
+  if (this->region_nodes(roi, &width, &height, &names).code() != StatusCode::OK)
+    return false;
+  return !this->writable(names);
 }
 
 Status SpinnakerDriver::get_region_of_interest(BoundingPoly* roi) {
@@ -569,60 +631,75 @@ Status SpinnakerDriver::get_iris(CameraSetting*) {
 }
 
 Status SpinnakerDriver::set_packet_delay(int const& packet_delay) {
+  // values the camera already holds skip the acquisition restart too, not only the write
+  if (holds_op_int(node_map(), "GevSCPD", packet_delay))
+    return is::make_status(StatusCode::OK);
   auto function = [&](int const& pd) -> Status {
-    is_assert_ok(set_op_int(node_map(), "GevSCPD", pd));
+    is_assert_ok(write_op_int(node_map(), "GevSCPD", pd));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, packet_delay);
+  return control_capture({"GevSCPD"}, function, packet_delay);
 }
 
 Status SpinnakerDriver::set_packet_size(int const& packet_size) {
+  if (holds_op_int(node_map(), "GevSCPSPacketSize", packet_size))
+    return is::make_status(StatusCode::OK);
   auto function = [&](int const& ps) -> Status {
-    is_assert_ok(set_op_int(node_map(), "GevSCPSPacketSize", ps));
+    is_assert_ok(write_op_int(node_map(), "GevSCPSPacketSize", ps));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, packet_size);
+  return control_capture({"GevSCPSPacketSize"}, function, packet_size);
 }
 
 Status SpinnakerDriver::reverse_x(bool enable) {
+  if (holds_op_bool(node_map(), "ReverseX", enable))
+    return is::make_status(StatusCode::OK);
   auto function = [&](bool e) -> Status {
-    is_assert_ok(set_op_bool(node_map(), "ReverseX", e));
+    is_assert_ok(write_op_bool(node_map(), "ReverseX", e));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, enable);
+  return control_capture({"ReverseX"}, function, enable);
 }
 
 Status SpinnakerDriver::reverse_y(bool enable) {
+  if (holds_op_bool(node_map(), "ReverseY", enable))
+    return is::make_status(StatusCode::OK);
   auto function = [&](bool e) -> Status {
-    is_assert_ok(set_op_bool(node_map(), "ReverseY", e));
+    is_assert_ok(write_op_bool(node_map(), "ReverseY", e));
     return is::make_status(StatusCode::OK);
   };
-  return control_capture(function, enable);
-}
-
-spn::INodeMap& SpinnakerDriver::node_map() const {
-  return this->cam->GetNodeMap();
-}
-
-std::vector<int> SpinnakerDriver::get_compression_parm() {
-  std::vector<int> parm;
-  if (this->image_format.has_compression()) {
-    auto value = this->image_format.compression().value();
-    if (this->image_format.format() == ImageFormats::PNG) {
-      parm.push_back(cv::IMWRITE_PNG_COMPRESSION);
-      int level = value * (9 - 0) + 0;
-      parm.push_back(level);
-    } else if (this->image_format.format() == ImageFormats::JPEG) {
-      parm.push_back(cv::IMWRITE_JPEG_QUALITY);
-      int level = value * (100 - 0) + 0;
-      parm.push_back(level);
-    } else if (this->image_format.format() == ImageFormats::WebP) {
-      parm.push_back(cv::IMWRITE_WEBP_QUALITY);
-      int level = value * (100 - 1) + 1;
-      parm.push_back(level);
-    }
+  return control_capture({"ReverseY"}, function, enable);
+}
+
+NodeCache& SpinnakerDriver::node_map() {
+  return this->nodes;
+}
+
+void SpinnakerDriver::apply_stream_settings() {
+  auto& stream = this->stream;
+  auto check = [](Status const& status) {
+    if (status.code() != StatusCode::OK)
+      is::warn("[Stream] {}", status);
+  };
+  if (!stream.buffer_handling.empty())
+    check(set_op_enum(this->stream_nodes, "StreamBufferHandlingMode", stream.buffer_handling));
+  if (stream.buffer_count > 0) {
+    check(set_op_enum(this->stream_nodes, "StreamBufferCountMode", "Manual"));
+    check(set_op_int(this->stream_nodes, "StreamBufferCountManual", stream.buffer_count));
+  }
+  if (!stream.packet_resend)
+    check(set_op_bool(this->stream_nodes, "StreamPacketResendEnable", false));
+  if (stream.packet_resend_timeout_ms > 0)
+    check(set_op_int(this->stream_nodes, "StreamPacketResendTimeout", stream.packet_resend_timeout_ms));
+  if (stream.packet_resend_max_requests > 0)
+    check(set_op_int(this->stream_nodes, "StreamPacketResendMaxRequests", stream.packet_resend_max_requests));
+
+  std::string handling;
+  int64_t count = 0;
+  if (get_op_enum(this->stream_nodes, "StreamBufferHandlingMode", &handling).code() == StatusCode::OK &&
+      get_op_int(this->stream_nodes, "StreamBufferCountResult", &count).code() == StatusCode::OK) {
+    is::info("[Stream] Buffer handling {} over {} buffers", handling, count);
   }
-  return parm;
 }
 
 }  // namespace camera
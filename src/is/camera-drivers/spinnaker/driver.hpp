@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <boost/bimap.hpp>
 #include <chrono>
 #include <cmath>
@@ -9,6 +10,9 @@
 #include <string>
 #include <vector>
 #include "is/camera-drivers/interface/camera-driver.hpp"
+#include "is/camera-drivers/utils/clock-estimator.hpp"
+#include "is/camera-drivers/utils/latency-histogram.hpp"
+#include "internal/nodes.hpp"
 #include "SpinGenApi/SpinnakerGenApi.h"
 #include "Spinnaker.h"
 
@@ -24,19 +28,28 @@ namespace camera {
 
 using namespace boost::bimaps;
 
+// Buffering of the transport layer stream, applied on connect. Empty or zero fields keep the SDK defaults.
+struct StreamSettings {
+  std::string buffer_handling;  // entry of StreamBufferHandlingMode, e.g. "NewestOnly"
+  int64_t buffer_count = 0;
+  bool packet_resend = true;
+  int64_t packet_resend_timeout_ms = 0;
+  int64_t packet_resend_max_requests = 0;
+};
+
 class SpinnakerDriver : public CameraDriver {
  public:
-  SpinnakerDriver();
+  explicit SpinnakerDriver(StreamSettings const& stream = StreamSettings());
 
   static std::vector<CameraInfo> find_cameras();
-  void connect(CameraInfo const& cam_info);
+  Status connect(CameraInfo const& cam_info) override;
   void start_capture() override;
   void stop_capture() override;
-  Image grab_image() override;
-  pb::Timestamp last_timestamp() override;
+  Status grab_frame(Frame* frame) override;
+  double timestamp_residual_ms() const override { return this->clock.residual_ms(); }
+  void set_counters(FrameCounters* counters) override { this->counters = counters; }
+  uint64_t saved_writes() const override { return this->nodes.saved_writes(); }
 
-  Status set_image_format(ImageFormat const& imgf) override;
-  Status get_image_format(ImageFormat* imgf) override;
   Status set_sampling_rate(pb::FloatValue const& rate) override;
   Status get_sampling_rate(pb::FloatValue* rate) override;
   Status set_color_space(ColorSpace const& color_space) override;
@@ -45,6 +58,9 @@ class SpinnakerDriver : public CameraDriver {
   Status get_resolution(Resolution* resolution) override;
   Status set_region_of_interest(BoundingPoly const& roi) override;
   Status get_region_of_interest(BoundingPoly* roi) override;
+  bool requires_restart(Resolution const& resolution) override;
+  bool requires_restart(ColorSpace const& color_space) override;
+  bool requires_restart(BoundingPoly const& roi) override;
   Status set_delay(pb::FloatValue const& delay) override;
   Status get_delay(pb::FloatValue* delay) override;
   Status set_shutter(CameraSetting const& shutter) override;
@@ -89,12 +105,15 @@ class SpinnakerDriver : public CameraDriver {
   Spinnaker::SystemPtr cam_system;
   Spinnaker::CameraList cam_list;
   Spinnaker::CameraPtr cam;
+  NodeCache nodes;  // of the camera node map, refilled on connect
+  NodeCache stream_nodes;
+  StreamSettings stream;
   int sensor_width, sensor_height, max_binning_h, max_binning_v, step_h, step_v;
   std::string resolution_info;
 
   bool is_capturing;
-  ImageFormat image_format;
-  is::pb::Timestamp timestamp;
+  ClockEstimator clock;
+  FrameCounters* counters;
 
   ColorSpaceBimap color_space_map;
 
@@ -109,8 +128,21 @@ class SpinnakerDriver : public CameraDriver {
     return status;
   }
 
-  Spinnaker::GenApi::INodeMap& node_map() const;
-  std::vector<int> get_compression_parm();
+  // Only stops acquisition when one of 'names' is locked while streaming. GenICam locks the nodes
+  // that change the payload (TLParamsLocked), others such as the offsets usually stay writable.
+  template <typename F, typename P>
+  Status control_capture(std::vector<std::string> const& names, F&& function, P const& value) {
+    if (this->is_capturing && this->writable(names))
+      return function(value);
+    return this->control_capture(function, value);
+  }
+
+  bool writable(std::vector<std::string> const& names);
+  // Size of the region of interest 'roi' asks for, and the nodes written to get there.
+  Status region_nodes(BoundingPoly const& roi, int64_t* width, int64_t* height, std::vector<std::string>* names);
+
+  NodeCache& node_map();
+  void apply_stream_settings();
 };
 
 }  // namespace camera
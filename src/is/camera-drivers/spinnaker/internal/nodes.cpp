@@ -10,40 +10,190 @@ using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
 }  // namespace spn
 
+NodeCache::NodeCache() : node_map(nullptr), saved(0) {}
+
+NodeCache::NodeCache(spn::INodeMap& node_map) : node_map(&node_map), saved(0) {}
+
+NodeCache::~NodeCache() {
+  this->clear();
+}
+
+void NodeCache::reset(spn::INodeMap* node_map) {
+  this->clear();
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->node_map = node_map;
+}
+
+void NodeCache::clear() {
+  std::unordered_map<std::string, spn::CallbackHandleType> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    callbacks.swap(this->callbacks);
+    this->nodes.clear();
+    this->ranges.clear();
+  }
+  for (auto& callback : callbacks)
+    spn::Deregister(callback.second);
+}
+
+spn::INode* NodeCache::node(std::string const& name) {
+  spn::INodeMap* node_map;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto pos = this->nodes.find(name);
+    if (pos != this->nodes.end())
+      return pos->second;
+    node_map = this->node_map;
+  }
+  // resolved without the lock, GenApi takes its own lock and runs the callbacks below with it held
+  auto node = node_map->GetNode(name.c_str());
+  if (node != nullptr) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->nodes.emplace(name, node);
+  }
+  return node;
+}
+
+OpRange<double> NodeCache::range(std::string const& name, spn::CIntegerPtr const& node) {
+  return this->cached_range(name, node);
+}
+
+OpRange<double> NodeCache::range(std::string const& name, spn::CFloatPtr const& node) {
+  return this->cached_range(name, node);
+}
+
+template <typename Ptr>
+OpRange<double> NodeCache::cached_range(std::string const& name, Ptr const& node) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto pos = this->ranges.find(name);
+    if (pos != this->ranges.end())
+      return pos->second;
+  }
+  // read without the lock, the SDK may run the callbacks below while reading
+  OpRange<double> range(node->GetMin(), node->GetMax());
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ranges[name] = range;
+    if (this->callbacks.find(name) != this->callbacks.end())
+      return range;
+  }
+  this->watch(name, node);
+  return range;
+}
+
+void NodeCache::watch(std::string const& name, spn::INode* node) {
+  auto callback = spn::Register(node, [this, name](spn::INode*) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ranges.erase(name);
+  });
+  bool registered;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    registered = this->callbacks.emplace(name, callback).second;
+  }
+  // another thread got there first
+  if (!registered)
+    spn::Deregister(callback);
+}
+
 bool is_writable(spn::INode* node) {
-  if (!spn::IsAvailable(node))
+  if (!spn::IsAvailable(node)) {
     is::warn("[{}] Not available.", node->GetName());
-  if (!spn::IsWritable(node))
+    return false;
+  }
+  if (!spn::IsWritable(node)) {
     is::warn("[{}] Not writable.", node->GetName());
-  return spn::IsAvailable(node) && spn::IsAvailable(node);
+    return false;
+  }
+  return true;
 }
 
 bool is_readable(spn::INode* node) {
-  if (!spn::IsAvailable(node))
+  if (!spn::IsAvailable(node)) {
     is::warn("[{}] Not available.", node->GetName());
-  if (!spn::IsReadable(node))
+    return false;
+  }
+  if (!spn::IsReadable(node)) {
     is::warn("[{}] Not readable.", node->GetName());
-  return spn::IsReadable(node);
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Compares what 'read' gets from the node with the value about to be written.
+template <typename Ptr, typename Read>
+bool holds_op(NodeCache& nodes, std::string const& name, Read read) {
+  auto node = nodes.node(name);
+  if (!spn::IsReadable(node))
+    return false;
+  Ptr prop = node;
+  if (!read(prop))
+    return false;
+  nodes.skip_write();
+  return true;
+}
+
+}  // namespace
+
+bool holds_op_bool(NodeCache& nodes, std::string const& name, bool value) {
+  return holds_op<spn::CBooleanPtr>(nodes, name, [&](auto const& prop) { return prop->GetValue() == value; });
+}
+
+bool holds_op_enum(NodeCache& nodes, std::string const& name, std::string const& value) {
+  return holds_op<spn::CEnumerationPtr>(nodes, name, [&](auto const& prop) {
+    auto entry = prop->GetCurrentEntry();
+    return entry != nullptr && std::string(entry->GetSymbolic().c_str()) == value;
+  });
 }
 
-Status set_op_bool(spn::INodeMap& node_map, std::string const& name, bool value) {
-  spn::CBooleanPtr prop = node_map.GetNode(name.c_str());
+bool holds_op_int(NodeCache& nodes, std::string const& name, int64_t value) {
+  return holds_op<spn::CIntegerPtr>(nodes, name, [&](auto const& prop) { return prop->GetValue() == value; });
+}
+
+bool holds_op_float(NodeCache& nodes, std::string const& name, float value) {
+  // compared at the precision it is written with
+  return holds_op<spn::CFloatPtr>(nodes, name,
+                                  [&](auto const& prop) { return static_cast<float>(prop->GetValue()) == value; });
+}
+
+bool holds_op_str(NodeCache& nodes, std::string const& name, std::string const& value) {
+  return holds_op<spn::CStringPtr>(nodes, name,
+                                   [&](auto const& prop) { return std::string(prop->GetValue().c_str()) == value; });
+}
+
+Status set_op_bool(NodeCache& nodes, std::string const& name, bool value) {
+  if (holds_op_bool(nodes, name, value))
+    return is::make_status(StatusCode::OK);
+  return write_op_bool(nodes, name, value);
+}
+
+Status write_op_bool(NodeCache& nodes, std::string const& name, bool value) {
+  spn::CBooleanPtr prop = nodes.node(name);
   if (!is_writable(prop))
     return writeability_error(name);
   prop->SetValue(value);
   return is::make_status(StatusCode::OK);
 }
 
-Status get_op_bool(spn::INodeMap& node_map, std::string const& name, bool* value) {
-  spn::CBooleanPtr prop = node_map.GetNode(name.c_str());
+Status get_op_bool(NodeCache& nodes, std::string const& name, bool* value) {
+  spn::CBooleanPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
   *value = prop->GetValue();
   return is::make_status(StatusCode::OK);
 }
 
-Status set_op_enum(spn::INodeMap& node_map, std::string const& name, std::string const& value) {
-  spn::CEnumerationPtr prop = node_map.GetNode(name.c_str());
+Status set_op_enum(NodeCache& nodes, std::string const& name, std::string const& value) {
+  if (holds_op_enum(nodes, name, value))
+    return is::make_status(StatusCode::OK);
+  return write_op_enum(nodes, name, value);
+}
+
+Status write_op_enum(NodeCache& nodes, std::string const& name, std::string const& value) {
+  spn::CEnumerationPtr prop = nodes.node(name);
   if (!is_writable(prop))
     return writeability_error(name);
   spn::CEnumEntryPtr entry = prop->GetEntryByName(value.c_str());
@@ -53,8 +203,8 @@ Status set_op_enum(spn::INodeMap& node_map, std::string const& name, std::string
   return is::make_status(StatusCode::OK);
 }
 
-Status get_op_enum(spn::INodeMap& node_map, std::string const& name, std::string* value) {
-  spn::CEnumerationPtr prop = node_map.GetNode(name.c_str());
+Status get_op_enum(NodeCache& nodes, std::string const& name, std::string* value) {
+  spn::CEnumerationPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
   auto v = prop->GetCurrentEntry()->GetSymbolic();
@@ -62,12 +212,19 @@ Status get_op_enum(spn::INodeMap& node_map, std::string const& name, std::string
   return is::make_status(StatusCode::OK);
 }
 
-Status set_op_int(spn::INodeMap& node_map, std::string const& name, int64_t value) {
-  spn::CIntegerPtr prop = node_map.GetNode(name.c_str());
+Status set_op_int(NodeCache& nodes, std::string const& name, int64_t value) {
+  if (holds_op_int(nodes, name, value))
+    return is::make_status(StatusCode::OK);
+  return write_op_int(nodes, name, value);
+}
+
+Status write_op_int(NodeCache& nodes, std::string const& name, int64_t value) {
+  spn::CIntegerPtr prop = nodes.node(name);
   if (!is_writable(prop))
     return writeability_error(name);
-  auto pmin = prop->GetMin();
-  auto pmax = prop->GetMax();
+  auto range = nodes.range(name, prop);
+  auto pmin = static_cast<int64_t>(range.min);
+  auto pmax = static_cast<int64_t>(range.max);
   if (value < pmin || value > pmax) {
     auto why = fmt::format("[{}] Value {} out of range. Current range: [{},{}]", name, value, pmin, pmax);
     return internal_error(StatusCode::OUT_OF_RANGE, why);
@@ -76,29 +233,37 @@ Status set_op_int(spn::INodeMap& node_map, std::string const& name, int64_t valu
   return is::make_status(StatusCode::OK);
 }
 
-Status get_op_int(spn::INodeMap& node_map, std::string const& name, int64_t* value) {
-  spn::CIntegerPtr prop = node_map.GetNode(name.c_str());
+Status get_op_int(NodeCache& nodes, std::string const& name, int64_t* value) {
+  spn::CIntegerPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
   *value = prop->GetValue();
   return is::make_status(StatusCode::OK);
 }
 
-Status minmax_op_int(spn::INodeMap& node_map, std::string const& name, OpRange<int64_t>* range) {
-  spn::CIntegerPtr prop = node_map.GetNode(name.c_str());
+Status minmax_op_int(NodeCache& nodes, std::string const& name, OpRange<int64_t>* range) {
+  spn::CIntegerPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
-  range->min = prop->GetMin();
-  range->max = prop->GetMax();
+  auto cached = nodes.range(name, prop);
+  range->min = static_cast<int64_t>(cached.min);
+  range->max = static_cast<int64_t>(cached.max);
   return is::make_status(StatusCode::OK);
 }
 
-Status set_op_float(spn::INodeMap& node_map, std::string const& name, float value) {
-  spn::CFloatPtr prop = node_map.GetNode(name.c_str());
+Status set_op_float(NodeCache& nodes, std::string const& name, float value) {
+  if (holds_op_float(nodes, name, value))
+    return is::make_status(StatusCode::OK);
+  return write_op_float(nodes, name, value);
+}
+
+Status write_op_float(NodeCache& nodes, std::string const& name, float value) {
+  spn::CFloatPtr prop = nodes.node(name);
   if (!is_writable(prop))
     return writeability_error(name);
-  auto pmin = prop->GetMin();
-  auto pmax = prop->GetMax();
+  auto range = nodes.range(name, prop);
+  auto pmin = range.min;
+  auto pmax = range.max;
   if (value < pmin || value > pmax) {
     auto why = fmt::format("[{}] Value {} out of range. Current range: [{},{}]", name, value, pmin, pmax);
     return internal_error(StatusCode::OUT_OF_RANGE, why);
@@ -107,41 +272,48 @@ Status set_op_float(spn::INodeMap& node_map, std::string const& name, float valu
   return is::make_status(StatusCode::OK);
 }
 
-Status get_op_float(spn::INodeMap& node_map, std::string const& name, float* value) {
-  spn::CFloatPtr prop = node_map.GetNode(name.c_str());
+Status get_op_float(NodeCache& nodes, std::string const& name, float* value) {
+  spn::CFloatPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
   *value = prop->GetValue();
   return is::make_status(StatusCode::OK);
 }
 
-Status minmax_op_float(spn::INodeMap& node_map, std::string const& name, OpRange<float>* range) {
-  spn::CFloatPtr prop = node_map.GetNode(name.c_str());
+Status minmax_op_float(NodeCache& nodes, std::string const& name, OpRange<float>* range) {
+  spn::CFloatPtr prop = nodes.node(name);
   if (!is_readable(prop))
     return readability_error(name);
-  range->min = prop->GetMin(); 
-  range->max = prop->GetMax();
+  auto cached = nodes.range(name, prop);
+  range->min = cached.min;
+  range->max = cached.max;
   return is::make_status(StatusCode::OK);
 }
 
-Status set_op_str(spn::INodeMap& node_map, std::string const& name, std::string const& value) {
-  spn::CStringPtr prop = node_map.GetNode(name.c_str());
+Status set_op_str(NodeCache& nodes, std::string const& name, std::string const& value) {
+  if (holds_op_str(nodes, name, value))
+    return is::make_status(StatusCode::OK);
+  return write_op_str(nodes, name, value);
+}
+
+Status write_op_str(NodeCache& nodes, std::string const& name, std::string const& value) {
+  spn::CStringPtr prop = nodes.node(name);
   if (!is_writable(prop))
     return writeability_error(name);
   prop->SetValue(value.c_str());
   return is::make_status(StatusCode::OK);
 }
 
-Status get_op_str(spn::INodeMap& node_map, std::string const& name, std::string* value) {
-  spn::CStringPtr prop = node_map.GetNode(name.c_str());
+Status get_op_str(NodeCache& nodes, std::string const& name, std::string* value) {
+  spn::CStringPtr prop = nodes.node(name);
   if (!is_readable(prop))
     readability_error(name);
   *value = std::string(prop->GetValue());
   return is::make_status(StatusCode::OK);
 }
 
-Status execute_op(spn::INodeMap& node_map, std::string const& name) {
-  spn::CCommandPtr prop = node_map.GetNode(name.c_str());
+Status execute_op(NodeCache& nodes, std::string const& name) {
+  spn::CCommandPtr prop = nodes.node(name);
   prop->Execute();
   return is::make_status(StatusCode::OK);
 }
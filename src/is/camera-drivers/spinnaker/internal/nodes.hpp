@@ -4,8 +4,12 @@
 #include <is/wire/core/status.hpp>
 #include <is/msgs/utils.hpp>
 #include <is/wire/core/logger.hpp>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 #include "SpinGenApi/SpinnakerGenApi.h"
 #include "Spinnaker.h"
 #include "is/camera-drivers/utils/utils.hpp"
@@ -20,27 +24,77 @@ using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
 }  // namespace spn
 
+// Nodes of a node map resolved by name once, so accessing them is a lookup instead of a GenApi search.
+// Ranges of numeric nodes are kept too, until the node reports a change, since most of them depend
+// on other nodes (e.g. exposure limits on the frame rate). Nodes stay valid while the node map lives.
+class NodeCache {
+ public:
+  NodeCache();
+  explicit NodeCache(spn::INodeMap& node_map);
+  ~NodeCache();
+  NodeCache(NodeCache const&) = delete;
+  NodeCache& operator=(NodeCache const&) = delete;
+
+  // Forgets everything resolved from the previous node map, e.g. on reconnection.
+  void reset(spn::INodeMap* node_map);
+  spn::INode* node(std::string const& name);
+  OpRange<double> range(std::string const& name, spn::CIntegerPtr const& node);
+  OpRange<double> range(std::string const& name, spn::CFloatPtr const& node);
+  // Accounts a write skipped because the node already held the value.
+  void skip_write() { ++this->saved; }
+  uint64_t saved_writes() const { return this->saved.load(); }
+
+ private:
+  template <typename Ptr>
+  OpRange<double> cached_range(std::string const& name, Ptr const& node);
+  // Forgets the range of the node when it reports a change. Called without 'mutex' held, like every
+  // GenApi call here: GenApi runs the callback, which takes 'mutex', with its own lock held.
+  void watch(std::string const& name, spn::INode* node);
+  void clear();
+
+  spn::INodeMap* node_map;
+  std::mutex mutex;  // node callbacks run on the thread writing the node or on the SDK event thread
+  std::unordered_map<std::string, spn::INode*> nodes;
+  std::unordered_map<std::string, OpRange<double>> ranges;
+  std::unordered_map<std::string, spn::CallbackHandleType> callbacks;
+  std::atomic<uint64_t> saved;
+};
+
 bool is_writable(spn::INode* node);
 bool is_readable(spn::INode* node);
 
-Status set_op_bool(spn::INodeMap& node_map, std::string const& name, bool value);
-Status get_op_bool(spn::INodeMap& node_map, std::string const& name, bool* value);
+// Whether the node currently holds 'value', read through the cached node. set_op_* skip the write,
+// and callers any acquisition restart around it, when it does. write_op_* write without checking,
+// for callers that checked already.
+bool holds_op_bool(NodeCache& nodes, std::string const& name, bool value);
+bool holds_op_enum(NodeCache& nodes, std::string const& name, std::string const& value);
+bool holds_op_int(NodeCache& nodes, std::string const& name, int64_t value);
+bool holds_op_float(NodeCache& nodes, std::string const& name, float value);
+bool holds_op_str(NodeCache& nodes, std::string const& name, std::string const& value);
+
+Status set_op_bool(NodeCache& nodes, std::string const& name, bool value);
+Status write_op_bool(NodeCache& nodes, std::string const& name, bool value);
+Status get_op_bool(NodeCache& nodes, std::string const& name, bool* value);
 
-Status set_op_enum(spn::INodeMap& node_map, std::string const& name, std::string const& value);
-Status get_op_enum(spn::INodeMap& node_map, std::string const& name, std::string* valule);
+Status set_op_enum(NodeCache& nodes, std::string const& name, std::string const& value);
+Status write_op_enum(NodeCache& nodes, std::string const& name, std::string const& value);
+Status get_op_enum(NodeCache& nodes, std::string const& name, std::string* valule);
 
-Status set_op_int(spn::INodeMap& node_map, std::string const& name, int64_t value);
-Status get_op_int(spn::INodeMap& node_map, std::string const& name, int64_t* value);
-Status minmax_op_int(spn::INodeMap& node_map, std::string const& name, OpRange<int64_t>* range);
+Status set_op_int(NodeCache& nodes, std::string const& name, int64_t value);
+Status write_op_int(NodeCache& nodes, std::string const& name, int64_t value);
+Status get_op_int(NodeCache& nodes, std::string const& name, int64_t* value);
+Status minmax_op_int(NodeCache& nodes, std::string const& name, OpRange<int64_t>* range);
 
-Status set_op_float(spn::INodeMap& node_map, std::string const& name, float value);
-Status get_op_float(spn::INodeMap& node_map, std::string const& name, float* value);
-Status minmax_op_float(spn::INodeMap& node_map, std::string const& name, OpRange<float>* range);
+Status set_op_float(NodeCache& nodes, std::string const& name, float value);
+Status write_op_float(NodeCache& nodes, std::string const& name, float value);
+Status get_op_float(NodeCache& nodes, std::string const& name, float* value);
+Status minmax_op_float(NodeCache& nodes, std::string const& name, OpRange<float>* range);
 
-Status set_op_str(spn::INodeMap& node_map, std::string const& name, std::string const& value);
-Status get_op_str(spn::INodeMap& node_map, std::string const& name, std::string* value);
+Status set_op_str(NodeCache& nodes, std::string const& name, std::string const& value);
+Status write_op_str(NodeCache& nodes, std::string const& name, std::string const& value);
+Status get_op_str(NodeCache& nodes, std::string const& name, std::string* value);
 
-Status execute_op(spn::INodeMap& node_map, std::string const& name);
+Status execute_op(NodeCache& nodes, std::string const& name);
 
 }  // namespace camera
 }  // namespace is
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "clock-estimator.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace is {
+namespace camera {
+
+namespace {
+
+// about the last thousand frames weigh in, enough to resolve drifts of a few parts per million
+constexpr double forgetting = 1e-3;
+// how much the floor rises per frame, so it forgets a lucky arrival after a while
+constexpr double floor_relax = 1e-5;
+// an arrival this far from the line can not be jitter, the camera clock was reset
+constexpr double max_residual = 1.0;
+
+}  // namespace
+
+ClockEstimator::ClockEstimator() : samples(0), residual(0.0) {}
+
+std::chrono::system_clock::time_point ClockEstimator::update(uint64_t device_ns,
+                                                             std::chrono::system_clock::time_point arrival) {
+  using namespace std::chrono;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto device = this->samples > 0 ? static_cast<int64_t>(device_ns - this->first_device) / 1e9 : 0.0;
+  auto host = this->samples > 0 ? duration<double>(arrival - this->first_host).count() : 0.0;
+
+  auto slope = this->var_device > 0 ? this->cov / this->var_device : 1.0;
+  auto distance = host - (this->mean_host + slope * (device - this->mean_device));
+  if (this->samples > 0 && (device < this->last_device || std::abs(distance) > max_residual))
+    this->samples = 0;
+
+  if (this->samples == 0) {
+    this->first_device = device_ns;
+    this->first_host = arrival;
+    device = host = distance = 0.0;
+    this->mean_device = this->mean_host = this->var_device = this->cov = 0.0;
+    this->floor = this->square_residual = 0.0;
+  }
+  ++this->samples;
+  this->last_device = device;
+
+  // plain averages while warming up, then a moving window
+  auto alpha = std::max(1.0 / this->samples, forgetting);
+  auto dx = device - this->mean_device;
+  auto dy = host - this->mean_host;
+  this->mean_device += alpha * dx;
+  this->mean_host += alpha * dy;
+  this->var_device = (1 - alpha) * (this->var_device + alpha * dx * dx);
+  this->cov = (1 - alpha) * (this->cov + alpha * dx * dy);
+
+  slope = this->var_device > 0 ? this->cov / this->var_device : 1.0;
+  distance = host - (this->mean_host + slope * (device - this->mean_device));
+  this->floor = this->samples == 1 ? distance : std::min(distance, this->floor + floor_relax);
+  this->square_residual += alpha * (distance * distance - this->square_residual);
+  this->residual.store(std::sqrt(this->square_residual) * 1e3);
+
+  auto mapped = this->mean_host + slope * (device - this->mean_device) + this->floor;
+  return this->first_host + duration_cast<system_clock::duration>(duration<double>(mapped));
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace is {
+namespace camera {
+
+// Maps the timestamps of a camera clock to the system clock. Every frame pairs its device timestamp
+// with the time it reached the host; a line fitted to these pairs with exponential forgetting tracks
+// the offset and drift between both clocks. Arrivals are delayed by transfer and scheduling, so the
+// line is lowered to the fastest arrivals seen lately, which leaves only the fixed part of the delay.
+// A clock that jumps back or away from the line, e.g. after the camera is reset, restarts the fit.
+class ClockEstimator {
+ public:
+  ClockEstimator();
+
+  // Accounts a frame stamped 'device_ns' by the camera and returns when it happened in system time.
+  std::chrono::system_clock::time_point update(uint64_t device_ns, std::chrono::system_clock::time_point arrival);
+  // Root mean square distance, in milliseconds, of the recent arrivals to the fitted line.
+  double residual_ms() const { return this->residual.load(); }
+
+ private:
+  std::mutex mutex;
+  uint64_t samples;
+  uint64_t first_device;  // origins of the fit, to keep the sums small
+  std::chrono::system_clock::time_point first_host;
+  double last_device;
+  // exponentially weighted moments, in seconds since the origins
+  double mean_device;
+  double mean_host;
+  double var_device;
+  double cov;
+  double floor;
+  double square_residual;
+  std::atomic<double> residual;
+};
+
+}  // namespace camera
+}  // namespace is
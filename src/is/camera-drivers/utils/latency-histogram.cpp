@@ -0,0 +1,86 @@
+#include "latency-histogram.hpp"
+#include <numeric>
+
+namespace is {
+namespace camera {
+
+namespace {
+
+constexpr std::size_t sub_bits = 4;
+
+std::size_t most_significant_bit(uint64_t value) {
+  std::size_t bit = 0;
+  while (value >>= 1)
+    ++bit;
+  return bit;
+}
+
+}  // namespace
+
+constexpr std::size_t LatencyHistogram::sub_buckets;
+constexpr std::size_t LatencyHistogram::size;
+
+LatencyHistogram::LatencyHistogram() {
+  for (auto& count : this->counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+std::size_t LatencyHistogram::bucket(uint64_t microseconds) {
+  if (microseconds < sub_buckets)
+    return microseconds;
+  // values in [2^k, 2^(k+1)) split in 16 buckets of 2^(k-4) each
+  auto k = most_significant_bit(microseconds);
+  auto index = sub_buckets * (k - sub_bits + 1) + ((microseconds >> (k - sub_bits)) - sub_buckets);
+  return std::min(index, size - 1);
+}
+
+uint64_t LatencyHistogram::upper_bound(std::size_t bucket) {
+  if (bucket < sub_buckets)
+    return bucket + 1;
+  auto k = bucket / sub_buckets + sub_bits - 1;
+  auto sub = bucket % sub_buckets;
+  return (sub_buckets + sub + 1) << (k - sub_bits);
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed) {
+  auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  this->counts[bucket(microseconds > 0 ? microseconds : 0)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::snapshot(std::vector<uint64_t>* counts) const {
+  counts->resize(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    (*counts)[i] = this->counts[i].load(std::memory_order_relaxed);
+  }
+}
+
+double LatencyHistogram::percentile(std::vector<uint64_t> const& counts, double q) {
+  auto total = std::accumulate(counts.begin(), counts.end(), uint64_t{0});
+  if (total == 0)
+    return 0.0;
+  auto rank = static_cast<uint64_t>(q * total);
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen > rank)
+      return upper_bound(i) / 1e3;
+  }
+  return upper_bound(counts.size() - 1) / 1e3;
+}
+
+char const* stage_name(Stage stage) {
+  switch (stage) {
+    case Stage::ACQUIRE: return "acquire";
+    case Stage::CONVERT: return "convert";
+    case Stage::DOWNSCALE: return "downscale";
+    case Stage::ENCODE: return "encode";
+    case Stage::SERIALIZE: return "serialize";
+    case Stage::PUBLISH: return "publish";
+    case Stage::CAPTURE_TO_PUBLISH: return "capture_to_publish";
+  }
+  return "";
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace is {
+namespace camera {
+
+// Lock free histogram of durations in microseconds. Buckets grow with the value, 16 per power of two,
+// so any percentile is read with at most 6% error from a few hundred counters, whatever the range.
+class LatencyHistogram {
+ public:
+  static constexpr std::size_t sub_buckets = 16;
+  static constexpr std::size_t size = sub_buckets * 33;  // up to 2^36us, about 19 hours
+
+  LatencyHistogram();
+
+  void record(std::chrono::steady_clock::duration elapsed);
+  // Counts recorded so far, resized to 'size' entries.
+  void snapshot(std::vector<uint64_t>* counts) const;
+
+  // Upper bound of the bucket holding fraction 'q' of 'counts', in milliseconds.
+  static double percentile(std::vector<uint64_t> const& counts, double q);
+  static std::size_t bucket(uint64_t microseconds);
+  static uint64_t upper_bound(std::size_t bucket);
+
+ private:
+  std::array<std::atomic<uint64_t>, size> counts;
+};
+
+// Stages a frame goes through, from the camera to the broker.
+enum class Stage {
+  ACQUIRE,             // waiting on the SDK for the next image
+  CONVERT,             // copying pixels out of the SDK buffer
+  DOWNSCALE,           // halving the frame for each simulcast pyramid level
+  ENCODE,              // compressing, or laying out a raw frame
+  SERIALIZE,           // building the message body, through the shared memory ring when enabled
+  PUBLISH,             // handing the message to the broker connection
+  CAPTURE_TO_PUBLISH,  // not a stage but the whole way, from the frame timestamp to published, so it
+                       // includes the time frames wait in the SDK buffers
+};
+constexpr std::size_t stage_count = 7;
+char const* stage_name(Stage stage);
+
+struct StageLatencies {
+  std::array<LatencyHistogram, stage_count> stages;
+  LatencyHistogram& operator[](Stage stage) { return this->stages[static_cast<std::size_t>(stage)]; }
+  LatencyHistogram const& operator[](Stage stage) const { return this->stages[static_cast<std::size_t>(stage)]; }
+  // Records the time elapsed since 'started' in 'stage'.
+  void record(Stage stage, std::chrono::steady_clock::time_point started) {
+    (*this)[stage].record(std::chrono::steady_clock::now() - started);
+  }
+};
+
+}  // namespace camera
+}  // namespace is
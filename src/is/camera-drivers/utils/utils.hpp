@@ -2,7 +2,9 @@
 
 #include <is/wire/core/status.hpp>
 #include <is/wire/core/logger.hpp>
+#include <atomic>
 #include <string>
+#include "latency-histogram.hpp"
 
 namespace is {
 namespace camera {
@@ -18,6 +20,32 @@ struct OpRange {
   T to_value(T const& ratio) { return ratio * (max - min) + min; }
 };
 
+// Bytes copied along the frame path, from the SDK buffer to the published payload.
+struct CopyCounter {
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> frames{0};
+  void add(std::size_t size) { bytes += size; }
+};
+
+// Heap allocations made by buffers along the frame path, detected as a change of capacity around a
+// write. Should stay at zero once the buffers have been warmed up to the current resolution.
+struct AllocationCounter {
+  std::atomic<uint64_t> allocations{0};
+  template <typename Buffer>
+  void track(std::size_t capacity, Buffer const& buffer) {
+    if (buffer.capacity() != capacity)
+      ++allocations;
+  }
+};
+
+// Everything accounted along the path of the frames of one camera. Owned by its gateway and shared
+// with the driver and encoder handling them, so cameras driven by the same process are kept apart.
+struct FrameCounters {
+  StageLatencies stages;
+  CopyCounter copies;
+  AllocationCounter allocations;
+};
+
 Status internal_error(StatusCode code, std::string const& why);
 Status writeability_error(std::string const& name);
 Status readability_error(std::string const& name);
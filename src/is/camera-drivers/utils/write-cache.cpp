@@ -0,0 +1,33 @@
+#include "write-cache.hpp"
+
+namespace is {
+namespace camera {
+
+WriteCache::WriteCache() : saved_writes(0) {}
+
+bool WriteCache::holds(std::string const& name, Value const& value) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto pos = this->values.find(name);
+  if (pos == this->values.end() || !(pos->second == value))
+    return false;
+  ++this->saved_writes;
+  return true;
+}
+
+void WriteCache::remember(std::string const& name, Value const& value) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->values[name] = value;
+}
+
+void WriteCache::forget(std::string const& name) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->values.erase(name);
+}
+
+void WriteCache::clear() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->values.clear();
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <boost/variant.hpp>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace is {
+namespace camera {
+
+// Values last written to a camera, by setting name, so writing one again can be skipped along with
+// any acquisition restart around it. It knows what was written, not what the camera holds: whatever
+// may change a setting behind the cache, e.g. a mode change, a dependent setting or automatic
+// control, has to forget it. Values must be passed with their exact type.
+class WriteCache {
+ public:
+  using Value = boost::variant<bool, int64_t, double, std::string>;
+
+  WriteCache();
+
+  // True, and accounted as a saved write, when 'name' is known to hold 'value'.
+  bool holds(std::string const& name, Value const& value);
+  void remember(std::string const& name, Value const& value);
+  void forget(std::string const& name);
+  void clear();
+  uint64_t saved() const { return this->saved_writes.load(); }
+
+ private:
+  std::mutex mutex;
+  std::unordered_map<std::string, Value> values;
+  std::atomic<uint64_t> saved_writes;
+};
+
+}  // namespace camera
+}  // namespace is
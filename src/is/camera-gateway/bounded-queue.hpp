@@ -0,0 +1,97 @@
+#ifndef __IS_BOUNDED_QUEUE_HPP__
+#define __IS_BOUNDED_QUEUE_HPP__
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace is {
+namespace camera {
+
+// Blocking FIFO with a fixed capacity used to join the pipeline stages. A full queue blocks the
+// producer, so a slow stage throttles the ones before it instead of growing a backlog. Items live in
+// a ring allocated up front, so pushing and popping never touches the heap.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(std::size_t capacity)
+      : items(std::max<std::size_t>(capacity, 1)), first(0), count(0) {}
+
+  void push(T&& item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_full.wait(lock, [this] { return this->count < this->items.size(); });
+    this->items[(this->first + this->count) % this->items.size()] = std::move(item);
+    ++this->count;
+    lock.unlock();
+    this->not_empty.notify_one();
+  }
+
+  // Never blocks: makes room by evicting the oldest items, and before that every item at the front
+  // 'stale' tells apart as superseded by the new one. Each evicted item is handed to 'evicted', so its
+  // buffers can be recycled.
+  template <typename S, typename F>
+  void push_evicting(T&& item, S&& stale, F&& evicted) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->count > 0 && (this->count == this->items.size() || stale(this->items[this->first]))) {
+      evicted(std::move(this->items[this->first]));
+      this->first = (this->first + 1) % this->items.size();
+      --this->count;
+    }
+    this->items[(this->first + this->count) % this->items.size()] = std::move(item);
+    ++this->count;
+    lock.unlock();
+    this->not_empty.notify_one();
+  }
+
+  void pop(T* item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_empty.wait(lock, [this] { return this->count > 0; });
+    this->take(item, lock);
+  }
+
+  // Never blocks, false if the queue is empty.
+  bool try_pop(T* item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->count == 0)
+      return false;
+    this->take(item, lock);
+    return true;
+  }
+
+  template <typename Rep, typename Period>
+  bool pop_for(T* item, std::chrono::duration<Rep, Period> const& timeout) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->not_empty.wait_for(lock, timeout, [this] { return this->count > 0; }))
+      return false;
+    this->take(item, lock);
+    return true;
+  }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->count;
+  }
+
+ private:
+  void take(T* item, std::unique_lock<std::mutex>& lock) {
+    *item = std::move(this->items[this->first]);
+    this->first = (this->first + 1) % this->items.size();
+    --this->count;
+    lock.unlock();
+    this->not_full.notify_one();
+  }
+
+  std::vector<T> items;
+  std::size_t first;
+  std::size_t count;
+  mutable std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_BOUNDED_QUEUE_HPP__
@@ -0,0 +1,42 @@
+#ifndef __IS_BUFFER_POOL_HPP__
+#define __IS_BUFFER_POOL_HPP__
+
+#include <mutex>
+#include <vector>
+
+namespace is {
+namespace camera {
+
+// Free list of frame and payload buffers shared by the pipeline stages. Released buffers keep their
+// capacity, so once every buffer in circulation has grown to the current resolution and format the
+// capture loop stops allocating. 'size' is the number of buffers expected to be in flight at once.
+template <typename Buffer>
+class BufferPool {
+ public:
+  explicit BufferPool(std::size_t size) { this->buffers.reserve(size); }
+
+  // Returns a recycled buffer, or a default constructed one while the pool is still warming up.
+  Buffer acquire() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->buffers.empty())
+      return Buffer();
+    auto buffer = std::move(this->buffers.back());
+    this->buffers.pop_back();
+    return buffer;
+  }
+
+  // Buffers are handed back as they are, whoever acquires one overwrites its contents.
+  void release(Buffer&& buffer) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->buffers.push_back(std::move(buffer));
+  }
+
+ private:
+  std::mutex mutex;
+  std::vector<Buffer> buffers;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_BUFFER_POOL_HPP__
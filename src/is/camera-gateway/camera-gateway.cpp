@@ -1,5 +1,11 @@
 #include "camera-gateway.hpp"
-#include <zipkin/opentracing.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <google/protobuf/util/message_differencer.h>
+#include <thread>
+#include "is/camera-drivers/encoder/downscale.hpp"
+#include "is/camera-drivers/utils/utils.hpp"
 
 namespace is {
 namespace camera {
@@ -10,64 +16,216 @@ using namespace std::chrono;
 using namespace zipkin;
 using namespace opentracing;
 
-CameraGateway::CameraGateway(CameraDriver* impl) : driver(impl) {}
+CameraGateway::CameraGateway(CameraDriver* impl, unsigned int id)
+    : id(id), driver(impl), encoder(&counters), controller(&encoder), capturing(false), dropped(0), source(0) {
+  this->driver->set_counters(&this->counters);
+}
+
+void CameraGateway::set_jpeg_options(JpegOptions const& options) {
+  JpegParameters parameters;
+  if (options.subsampling() == JpegOptions::CHROMA_422)
+    parameters.subsampling = ChromaSubsampling::S422;
+  else if (options.subsampling() == JpegOptions::CHROMA_444)
+    parameters.subsampling = ChromaSubsampling::S444;
+  parameters.optimize_huffman = options.optimize_huffman();
+  parameters.fast_dct = options.fast_dct();
+  this->encoder.set_jpeg_parameters(parameters);
+}
+
+void CameraGateway::set_raw_output(bool raw) {
+  if (raw)
+    is::info("Publishing raw frames, image format is ignored");
+  this->encoder.set_raw(raw);
+}
+
+Status CameraGateway::set_compression_target(CompressionTarget const& target) {
+  return this->controller.set_target(target);
+}
+
+namespace {
+
+// A write of one field of a CameraConfig, along with the write restoring the value it replaces.
+struct ConfigWrite {
+  std::function<Status()> apply;
+  std::function<Status()> revert;  // empty when the previous value couldn't be read
+  bool restarts;                   // acquisition must be stopped to write it, see CameraDriver::requires_restart
+};
+
+// Queues the write of 'wanted' unless the field already holds it.
+template <typename T>
+void add_write(std::vector<ConfigWrite>* writes, T const& wanted, std::function<Status(T*)> get,
+               std::function<Status(T const&)> set, bool restarts = false) {
+  T current;
+  auto read = get(&current);
+  auto known = read.code() == StatusCode::OK;
+  if (known && pb::MessageDifferencer::Equivalent(current, wanted))
+    return;
+  ConfigWrite write;
+  write.apply = [set, wanted] { return set(wanted); };
+  if (known)
+    write.revert = [set, current] { return set(current); };
+  write.restarts = restarts;
+  writes->push_back(std::move(write));
+}
+
+using SettingGetter = Status (CameraDriver::*)(CameraSetting*);
+
+// Getters of the camera settings, by field name in CameraSettings.
+std::map<std::string, SettingGetter> const& setting_getters() {
+  static std::map<std::string, SettingGetter> const getters{
+      {"brightness", &CameraDriver::get_brightness},
+      {"exposure", &CameraDriver::get_exposure},
+      {"focus", &CameraDriver::get_focus},
+      {"gain", &CameraDriver::get_gain},
+      {"gamma", &CameraDriver::get_gamma},
+      {"hue", &CameraDriver::get_hue},
+      {"iris", &CameraDriver::get_iris},
+      {"saturation", &CameraDriver::get_saturation},
+      {"sharpness", &CameraDriver::get_sharpness},
+      {"shutter", &CameraDriver::get_shutter},
+      {"white_balance_bu", &CameraDriver::get_white_balance_bu},
+      {"white_balance_rv", &CameraDriver::get_white_balance_rv},
+      {"zoom", &CameraDriver::get_zoom},
+  };
+  return getters;
+}
+
+}  // namespace
+
+void CameraGateway::start_capture() {
+  std::lock_guard<std::mutex> lock(this->driver_mutex);
+  this->driver->start_capture();
+  this->capturing = true;
+}
 
+// Applied as a transaction: only the fields that differ from the current ones are written, stream
+// format first, with acquisition restarted at most once for all of them. When a write fails the
+// ones before it are reverted, in reverse order.
 Status CameraGateway::set_configuration(CameraConfig const& config) {
-  // TODO: receovery previous context
+  std::lock_guard<std::mutex> lock(this->driver_mutex);
+  auto driver = this->driver;
+  std::vector<ConfigWrite> writes;
+  auto add_setting = [&](CameraSetting const& wanted, Status (CameraDriver::*get)(CameraSetting*),
+                         Status (CameraDriver::*set)(CameraSetting const&)) {
+    add_write<CameraSetting>(&writes, wanted, [=](CameraSetting* s) { return (driver->*get)(s); },
+                             [=](CameraSetting const& s) { return (driver->*set)(s); });
+  };
+
   if (config.has_image()) {
     auto& img_s = config.image();
-    if (img_s.has_resolution())
-      is_assert_set(driver->set_resolution(img_s.resolution()));
-    if (img_s.has_color_space())
-      is_assert_set(driver->set_color_space(img_s.color_space()));
-    if (img_s.has_format())
-      is_assert_set(driver->set_image_format(img_s.format()));
-    if (img_s.has_region())
-      is_assert_set(driver->set_region_of_interest(img_s.region()));
+    // a new resolution resets the region of interest, so the region goes last
+    if (img_s.has_resolution()) {
+      add_write<Resolution>(&writes, img_s.resolution(), [=](Resolution* r) { return driver->get_resolution(r); },
+                            [=](Resolution const& r) { return driver->set_resolution(r); },
+                            driver->requires_restart(img_s.resolution()));
+    }
+    if (img_s.has_color_space()) {
+      add_write<ColorSpace>(&writes, img_s.color_space(), [=](ColorSpace* c) { return driver->get_color_space(c); },
+                            [=](ColorSpace const& c) { return driver->set_color_space(c); },
+                            driver->requires_restart(img_s.color_space()));
+    }
+    if (img_s.has_format()) {
+      add_write<ImageFormat>(&writes, img_s.format(),
+                             [this](ImageFormat* f) {
+                               *f = this->encoder.format();
+                               return is::make_status(StatusCode::OK);
+                             },
+                             [this](ImageFormat const& f) { return this->encoder.set_format(f); });
+    }
+    if (img_s.has_region()) {
+      add_write<BoundingPoly>(&writes, img_s.region(),
+                              [=](BoundingPoly* r) { return driver->get_region_of_interest(r); },
+                              [=](BoundingPoly const& r) { return driver->set_region_of_interest(r); },
+                              driver->requires_restart(img_s.region()));
+    }
   }
 
   if (config.has_sampling()) {
     auto& smp_s = config.sampling();
-    if (smp_s.has_frequency())
-      is_assert_set(driver->set_sampling_rate(smp_s.frequency()));
-    if (smp_s.has_delay())
-      is_assert_set(driver->set_delay(smp_s.delay()));
+    if (smp_s.has_frequency()) {
+      add_write<pb::FloatValue>(&writes, smp_s.frequency(),
+                                [=](pb::FloatValue* f) { return driver->get_sampling_rate(f); },
+                                [=](pb::FloatValue const& f) { return driver->set_sampling_rate(f); });
+    }
+    if (smp_s.has_delay()) {
+      add_write<pb::FloatValue>(&writes, smp_s.delay(), [=](pb::FloatValue* d) { return driver->get_delay(d); },
+                                [=](pb::FloatValue const& d) { return driver->set_delay(d); });
+    }
   }
 
   if (config.has_camera()) {
     auto& cam_s = config.camera();
     if (cam_s.has_brightness())
-      is_assert_set(driver->set_brightness(cam_s.brightness()));
+      add_setting(cam_s.brightness(), &CameraDriver::get_brightness, &CameraDriver::set_brightness);
     if (cam_s.has_exposure())
-      is_assert_set(driver->set_exposure(cam_s.exposure()));
+      add_setting(cam_s.exposure(), &CameraDriver::get_exposure, &CameraDriver::set_exposure);
     if (cam_s.has_focus())
-      is_assert_set(driver->set_focus(cam_s.focus()));
+      add_setting(cam_s.focus(), &CameraDriver::get_focus, &CameraDriver::set_focus);
     if (cam_s.has_gain())
-      is_assert_set(driver->set_gain(cam_s.gain()));
+      add_setting(cam_s.gain(), &CameraDriver::get_gain, &CameraDriver::set_gain);
     if (cam_s.has_gamma())
-      is_assert_set(driver->set_gamma(cam_s.gamma()));
+      add_setting(cam_s.gamma(), &CameraDriver::get_gamma, &CameraDriver::set_gamma);
     if (cam_s.has_hue())
-      is_assert_set(driver->set_hue(cam_s.hue()));
+      add_setting(cam_s.hue(), &CameraDriver::get_hue, &CameraDriver::set_hue);
     if (cam_s.has_iris())
-      is_assert_set(driver->set_iris(cam_s.iris()));
+      add_setting(cam_s.iris(), &CameraDriver::get_iris, &CameraDriver::set_iris);
     if (cam_s.has_saturation())
-      is_assert_set(driver->set_saturation(cam_s.saturation()));
+      add_setting(cam_s.saturation(), &CameraDriver::get_saturation, &CameraDriver::set_saturation);
     if (cam_s.has_sharpness())
-      is_assert_set(driver->set_sharpness(cam_s.sharpness()));
+      add_setting(cam_s.sharpness(), &CameraDriver::get_sharpness, &CameraDriver::set_sharpness);
     if (cam_s.has_shutter())
-      is_assert_set(driver->set_shutter(cam_s.shutter()));
+      add_setting(cam_s.shutter(), &CameraDriver::get_shutter, &CameraDriver::set_shutter);
     if (cam_s.has_white_balance_bu())
-      is_assert_set(driver->set_white_balance_bu(cam_s.white_balance_bu()));
+      add_setting(cam_s.white_balance_bu(), &CameraDriver::get_white_balance_bu, &CameraDriver::set_white_balance_bu);
     if (cam_s.has_white_balance_rv())
-      is_assert_set(driver->set_white_balance_rv(cam_s.white_balance_rv()));
+      add_setting(cam_s.white_balance_rv(), &CameraDriver::get_white_balance_rv, &CameraDriver::set_white_balance_rv);
     if (cam_s.has_zoom())
-      is_assert_set(driver->set_zoom(cam_s.zoom()));
+      add_setting(cam_s.zoom(), &CameraDriver::get_zoom, &CameraDriver::set_zoom);
   }
 
-  return is::make_status(StatusCode::OK);
+  // the driver tells which writes the camera does not take while streaming. A single one is left to the
+  // driver, which restarts acquisition around it, several are batched within one restart
+  auto restarts = std::count_if(writes.begin(), writes.end(), [](auto& w) { return w.restarts; });
+  auto restart = this->capturing && restarts > 1;
+  if (restart)
+    driver->stop_capture();
+
+  auto status = is::make_status(StatusCode::OK);
+  std::size_t applied = 0;
+  for (; applied < writes.size(); ++applied) {
+    status = writes[applied].apply();
+    if (status.code() != StatusCode::OK)
+      break;
+  }
+  if (status.code() != StatusCode::OK) {
+    while (applied-- > 0) {
+      if (!writes[applied].revert) {
+        is::warn("[SetConfig] Unable to restore a setting, its previous value is unknown");
+        continue;
+      }
+      auto reverted = writes[applied].revert();
+      if (reverted.code() != StatusCode::OK)
+        is::warn("[SetConfig] Unable to restore a setting: {}", reverted);
+    }
+  }
+
+  if (restart)
+    driver->start_capture();
+
+  // read back rather than copied from the request, the camera may have adjusted the values
+  FieldSelector touched;
+  if (config.has_image())
+    touched.add_fields(CameraConfigFields::IMAGE_SETTINGS);
+  if (config.has_sampling())
+    touched.add_fields(CameraConfigFields::SAMPLING_SETTINGS);
+  if (config.has_camera())
+    touched.add_fields(CameraConfigFields::CAMERA_SETTINGS);
+  if (!writes.empty() && touched.fields_size() > 0)
+    this->update_shadow(touched);
+  return status;
 }
 
-Status CameraGateway::get_configuration(FieldSelector const& field_selector, CameraConfig* camera_config) {
+Status CameraGateway::read_configuration(FieldSelector const& field_selector, CameraConfig* camera_config) {
   auto begin = field_selector.fields().begin();
   auto end = field_selector.fields().end();
   auto pos = std::find(begin, end, CameraConfigFields::ALL);
@@ -88,7 +246,7 @@ Status CameraGateway::get_configuration(FieldSelector const& field_selector, Cam
       auto img_s = camera_config->mutable_image();
       is_assert_get(driver->get_resolution(img_s->mutable_resolution()), img_s->release_resolution());
       is_assert_get(driver->get_color_space(img_s->mutable_color_space()), img_s->release_color_space());
-      is_assert_get(driver->get_image_format(img_s->mutable_format()), img_s->release_format());
+      *img_s->mutable_format() = encoder.format();
       is_assert_get(driver->get_region_of_interest(img_s->mutable_region()), img_s->release_region());
     } else if (field == CameraConfigFields::SAMPLING_SETTINGS) {
       auto smp_s = camera_config->mutable_sampling();
@@ -115,62 +273,501 @@ Status CameraGateway::get_configuration(FieldSelector const& field_selector, Cam
   return is::make_status(StatusCode::OK);
 }
 
-void CameraGateway::run(std::string const& uri, unsigned int const& id, std::string const& zipkin_host,
-                        uint32_t const& zipkin_port, is::vision::CameraConfig const& initial_config) {
-  is::info("Trying to connect to {}", uri);
+void CameraGateway::update_shadow(FieldSelector const& field_selector) {
+  CameraConfig config;
+  auto status = this->read_configuration(field_selector, &config);
+  if (status.code() != StatusCode::OK) {
+    is::warn("[GetConfig] Unable to read the configuration back: {}", status);
+    return;
+  }
+  auto now = is::to_timestamp(system_clock::now());
+  std::lock_guard<std::mutex> lock(this->shadow_mutex);
+  if (config.has_image()) {
+    *this->shadow.mutable_image() = config.image();
+    *this->freshness.mutable_image() = now;
+  }
+  if (config.has_sampling()) {
+    *this->shadow.mutable_sampling() = config.sampling();
+    *this->freshness.mutable_sampling() = now;
+  }
+  if (config.has_camera()) {
+    *this->shadow.mutable_camera() = config.camera();
+    std::vector<pb::FieldDescriptor const*> present;
+    config.camera().GetReflection()->ListFields(config.camera(), &present);
+    for (auto field : present) {
+      (*this->freshness.mutable_camera())[field->name()] = now;
+    }
+  }
+}
 
-  auto channel = is::Channel(uri);
-  auto provider = is::ServiceProvider(channel);
+// Served from the shadow configuration, without touching the camera.
+Status CameraGateway::get_configuration(FieldSelector const& field_selector, CameraConfig* camera_config) {
+  auto const& fields = field_selector.fields();
+  auto all = std::find(fields.begin(), fields.end(), CameraConfigFields::ALL) != fields.end();
+  auto selected = [&](CameraConfigFields field) {
+    return all || std::find(fields.begin(), fields.end(), field) != fields.end();
+  };
+  std::lock_guard<std::mutex> lock(this->shadow_mutex);
+  if (selected(CameraConfigFields::IMAGE_SETTINGS) && this->shadow.has_image())
+    *camera_config->mutable_image() = this->shadow.image();
+  if (selected(CameraConfigFields::SAMPLING_SETTINGS) && this->shadow.has_sampling())
+    *camera_config->mutable_sampling() = this->shadow.sampling();
+  if (selected(CameraConfigFields::CAMERA_SETTINGS) && this->shadow.has_camera())
+    *camera_config->mutable_camera() = this->shadow.camera();
+  return is::make_status(StatusCode::OK);
+}
 
-  ZipkinOtTracerOptions zp_options;
-  zp_options.service_name = fmt::format("CameraGateway.{}", id);
-  zp_options.collector_host = zipkin_host;
-  zp_options.collector_port = zipkin_port;
-  auto tracer = makeZipkinOtTracer(zp_options);
-  channel.set_tracer(tracer);
+void CameraGateway::refresh_automatic() {
+  auto started = steady_clock::now();
+  if (started - this->last_refresh < this->refresh_period)
+    return;
+  this->last_refresh = started;
 
-  auto log_interceptor = is::LogInterceptor();
-  provider.add_interceptor(log_interceptor);
+  CameraSettings settings;
+  {
+    std::lock_guard<std::mutex> lock(this->shadow_mutex);
+    settings = this->shadow.camera();
+  }
+  auto reflection = settings.GetReflection();
+  std::vector<pb::FieldDescriptor const*> present;
+  reflection->ListFields(settings, &present);
+  std::vector<pb::FieldDescriptor const*> refreshed;
+  {
+    std::lock_guard<std::mutex> lock(this->driver_mutex);
+    for (auto field : present) {
+      auto setting = static_cast<CameraSetting*>(reflection->MutableMessage(&settings, field));
+      auto getter = setting_getters().find(field->name());
+      if (!setting->automatic() || getter == setting_getters().end())
+        continue;
+      if ((this->driver->*getter->second)(setting).code() == StatusCode::OK)
+        refreshed.push_back(field);
+    }
+  }
+  if (refreshed.empty())
+    return;
+
+  auto now = is::to_timestamp(system_clock::now());
+  std::lock_guard<std::mutex> lock(this->shadow_mutex);
+  for (auto field : refreshed) {
+    reflection->MutableMessage(this->shadow.mutable_camera(), field)->CopyFrom(reflection->GetMessage(settings, field));
+    (*this->freshness.mutable_camera())[field->name()] = now;
+  }
+}
+
+Status CameraGateway::enqueue_configuration(CameraConfig const& config) {
+  std::packaged_task<Status()> command([this, config] { return this->set_configuration(config); });
+  auto result = command.get_future();
+  {
+    std::lock_guard<std::mutex> lock(this->commands_mutex);
+    this->commands.push_back(std::move(command));
+  }
+  return result.get();
+}
 
+void CameraGateway::apply_configurations() {
+  std::deque<std::packaged_task<Status()>> pending;
+  {
+    std::lock_guard<std::mutex> lock(this->commands_mutex);
+    pending.swap(this->commands);
+  }
+  for (auto& command : pending) {
+    command();
+  }
+}
+
+void CameraGateway::open(CameraGatewayOptions const& options, CameraConfig const& initial_config,
+                         GatewayContext const& context) {
+  this->context = context;
   this->set_configuration(initial_config);
+  this->refresh_period = milliseconds(options.config_refresh_ms() > 0 ? options.config_refresh_ms() : 1000);
+  this->last_refresh = steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(this->driver_mutex);
+    FieldSelector all;
+    all.add_fields(CameraConfigFields::ALL);
+    this->update_shadow(all);
+  }
+  auto id = this->id;
+
+  // pyramid levels halve the one before them, only those asked for get a stream and are published
+  this->frame_topics = {fmt::format("CameraGateway.{}.Frame", id)};
+  this->level_streams = {0};
+  for (auto downscale : options.simulcast().downscales()) {
+    if (downscale < 2 || (downscale & (downscale - 1)) != 0) {
+      is::warn("Ignoring simulcast downscale {}, must be a power of two greater than 1", downscale);
+      continue;
+    }
+    std::size_t level = 0;
+    while ((1u << level) < downscale)
+      ++level;
+    if (this->level_streams.size() <= level)
+      this->level_streams.resize(level + 1, -1);
+    if (this->level_streams[level] >= 0)
+      continue;
+    this->level_streams[level] = this->frame_topics.size();
+    this->frame_topics.push_back(fmt::format("CameraGateway.{}.Frame.{}", id, downscale));
+    is::info("Simulcast: publishing 1/{} scale on {}", downscale, this->frame_topics.back());
+  }
+  // crops of the full resolution frame, each one published as a stream of its own
+  for (auto const& region_options : options.regions()) {
+    auto topic = fmt::format("CameraGateway.{}.Frame.{}", id, region_options.name());
+    if (region_options.name().empty() ||
+        std::find(this->frame_topics.begin(), this->frame_topics.end(), topic) != this->frame_topics.end()) {
+      is::warn("Ignoring region '{}', its name must be non empty and unique", region_options.name());
+      continue;
+    }
+    Region region;
+    region.x = region_options.x();
+    region.y = region_options.y();
+    region.width = region_options.width();
+    region.height = region_options.height();
+    this->crops.push_back(region);
+    this->crop_streams.push_back(this->frame_topics.size());
+    this->frame_topics.push_back(topic);
+    is::info("Region: publishing {}x{}+{}+{} on {}", region.width, region.height, region.x, region.y, topic);
+  }
+  this->timestamp_topic = fmt::format("CameraGateway.{}.Timestamp", id);
+  auto& shared_memory = options.shared_memory();
+  if (shared_memory.enabled()) {
+    auto slots = shared_memory.slots() > 0 ? shared_memory.slots() : 8;
+    auto slot_size = shared_memory.slot_size() > 0 ? shared_memory.slot_size() : 16 * 1024 * 1024;
+    this->ring = std::make_unique<SharedMemoryRing>(fmt::format("/CameraGateway.{}", id), slots, slot_size);
+    // descriptors and images never share a topic, frames that do not fit in the ring still go to the frame topic
+    auto frame_prefix = fmt::format("CameraGateway.{}.Frame", id);
+    for (auto const& topic : this->frame_topics)
+      this->shared_topics.push_back(
+          fmt::format("CameraGateway.{}.SharedFrame{}", id, topic.substr(frame_prefix.size())));
+    this->ring_warned.assign(this->shared_topics.size(), false);
+  }
+
+  this->metrics_topic = fmt::format("CameraGateway.{}.Metrics", id);
+  auto& pipeline = options.pipeline();
+  this->late_after = milliseconds(pipeline.late_after_ms() > 0 ? pipeline.late_after_ms() : 100);
+  this->last_metrics = this->last_report = steady_clock::now();
+  this->sampler = std::make_unique<TraceSampler>(options.tracing());
+}
 
-  provider.delegate<CameraConfig, is::pb::Empty>(
-      fmt::format("CameraGateway.{}.SetConfig", id),
+void CameraGateway::serve(is::ServiceProvider* provider) {
+  provider->delegate<CameraConfig, is::pb::Empty>(
+      fmt::format("CameraGateway.{}.SetConfig", this->id),
       [this](Context*, CameraConfig const& config, is::pb::Empty*) -> Status {
-        return this->set_configuration(config);
+        return this->enqueue_configuration(config);
       });
 
-  provider.delegate<FieldSelector, CameraConfig>(
-      fmt::format("CameraGateway.{}.GetConfig", id),
+  provider->delegate<FieldSelector, CameraConfig>(
+      fmt::format("CameraGateway.{}.GetConfig", this->id),
       [this](Context*, FieldSelector const& field_selector, CameraConfig* camera_config) -> Status {
         return this->get_configuration(field_selector, camera_config);
       });
 
-  is::info("Starting to capture");
-  driver->start_capture();
-  for (;;) {
-    auto image = driver->grab_image();
+  provider->delegate<is::pb::Empty, ConfigFreshness>(
+      fmt::format("CameraGateway.{}.GetConfigFreshness", this->id),
+      [this](Context*, is::pb::Empty const&, ConfigFreshness* freshness) -> Status {
+        std::lock_guard<std::mutex> lock(this->shadow_mutex);
+        *freshness = this->freshness;
+        return is::make_status(StatusCode::OK);
+      });
 
-    if (image.data().size() > 0) {
-      auto im_msg = Message(image);
-      auto timestamp = driver->last_timestamp();
+  provider->delegate<CompressionTarget, is::pb::Empty>(
+      fmt::format("CameraGateway.{}.SetCompressionTarget", this->id),
+      [this](Context*, CompressionTarget const& target, is::pb::Empty*) -> Status {
+        return this->set_compression_target(target);
+      });
 
-      auto span = tracer->StartSpan("Frame", {opentracing::v1::StartTimestamp(is::to_system_clock(timestamp))});
-      is::OtWriter ot_writer(&im_msg);
-      tracer->Inject(span->context(), ot_writer);
-      channel.publish(fmt::format("CameraGateway.{}.Frame", id), im_msg);
-      span->Finish();
+  provider->delegate<is::pb::Empty, CompressionTarget>(
+      fmt::format("CameraGateway.{}.GetCompressionTarget", this->id),
+      [this](Context*, is::pb::Empty const&, CompressionTarget* target) -> Status {
+        *target = this->controller.target();
+        return is::make_status(StatusCode::OK);
+      });
+}
+
+void CameraGateway::publish(EncodedFrame const& frame) {
+  auto const& payload = frame.payload;
+  auto const& timestamp = frame.timestamp;
+  auto& latencies = this->counters.stages;
+  auto started = steady_clock::now();
+  Message im_msg;
+  auto topic = &this->frame_topics[frame.stream];
+  if (this->ring && this->ring->write(payload, timestamp, &this->shared_frame)) {
+    this->counters.copies.add(payload.size());
+    this->shared_frame.SerializeToString(&this->descriptor);
+    im_msg.set_body(this->descriptor);
+    topic = &this->shared_topics[frame.stream];
+  } else {
+    if (this->ring) {
+      // counted in the metrics, a slot too small for a stream would otherwise warn on every frame
+      this->metrics.set_ring_fallbacks(this->metrics.ring_fallbacks() + 1);
+      if (!this->ring_warned[frame.stream]) {
+        is::warn("[SharedMemory] Frame of {} bytes from stream {} does not fit in a slot, sent through the broker",
+                 payload.size(), frame.stream);
+        this->ring_warned[frame.stream] = true;
+      }
+    }
+    im_msg.set_body(payload);
+  }
+  im_msg.set_content_type(is::wire::ContentType::PROTOBUF);
+  latencies.record(Stage::SERIALIZE, started);
 
+  auto& tracer = this->context.tracer;
+  std::unique_ptr<opentracing::Span> span, publish_span;
+  if (frame.traced) {
+    // the stages before publishing already happened, their spans are stamped after the fact
+    auto captured = is::to_system_clock(timestamp);
+    span = tracer->StartSpan("Frame", {opentracing::v1::StartTimestamp(captured)});
+    span->SetTag("camera", this->id);
+    auto parent = &span->context();
+    auto encode_finished = frame.encode_started + duration_cast<steady_clock::duration>(
+                                                       duration<double, std::milli>(frame.encode_time_ms));
+    tracer->StartSpan("Acquire", {opentracing::v1::ChildOf(parent), opentracing::v1::StartTimestamp(captured)})
+        ->Finish({opentracing::v1::FinishTimestamp(frame.acquired)});
+    tracer
+        ->StartSpan("Encode", {opentracing::v1::ChildOf(parent), opentracing::v1::StartTimestamp(frame.encode_started)})
+        ->Finish({opentracing::v1::FinishTimestamp(encode_finished)});
+    is::OtWriter ot_writer(&im_msg);
+    tracer->Inject(span->context(), ot_writer);
+    publish_span = tracer->StartSpan("Publish", {opentracing::v1::ChildOf(parent)});
+  }
+  {
+    std::lock_guard<std::mutex> lock(*this->context.channel_mutex);
+    started = steady_clock::now();
+    this->context.channel->publish(*topic, im_msg);
+    latencies.record(Stage::PUBLISH, started);
+    latencies[Stage::CAPTURE_TO_PUBLISH].record(
+        duration_cast<steady_clock::duration>(system_clock::now() - is::to_system_clock(timestamp)));
+    if (frame.stream == 0) {
       auto ts_msg = Message(timestamp);
-      channel.publish(fmt::format("CameraGateway.{}.Timestamp", id), ts_msg);
+      this->context.channel->publish(this->timestamp_topic, ts_msg);
+    }
+  }
+  if (span) {
+    publish_span->Finish();
+    span->Finish();
+  }
+
+  auto& metrics = this->metrics;
+  this->controller.update(payload.size(), frame.encode_time_ms, timestamp);
+  metrics.set_delivered(metrics.delivered() + 1);
+  if (system_clock::now() - is::to_system_clock(timestamp) > this->late_after)
+    metrics.set_late(metrics.late() + 1);
+  if (steady_clock::now() - this->last_metrics > seconds(1)) {
+    metrics.set_dropped(this->dropped.load());
+    this->controller.fill(&metrics);
+    metrics.set_timestamp_residual_ms(this->driver->timestamp_residual_ms());
+    metrics.set_saved_writes(this->driver->saved_writes());
+    this->stages.fill(this->counters.stages, &metrics);
+    if (this->context.exporter)
+      this->context.exporter->update(this->id, metrics);
+    auto metrics_msg = Message(metrics);
+    {
+      std::lock_guard<std::mutex> lock(*this->context.channel_mutex);
+      this->context.channel->publish(this->metrics_topic, metrics_msg);
+    }
+    this->last_metrics = steady_clock::now();
+  }
+
+  auto& copies = this->counters.copies;
+  ++copies.frames;
+  if (steady_clock::now() - this->last_report > seconds(10)) {
+    auto frames = std::max<uint64_t>(copies.frames.exchange(0), 1);
+    is::info("[Camera {}] {} bytes copied per frame, {} buffer allocations", this->id,
+             copies.bytes.exchange(0) / frames, this->counters.allocations.allocations.exchange(0));
+    this->last_report = steady_clock::now();
+  }
+}
+
+void CameraGateway::capture() {
+  std::vector<Frame> pyramid(this->level_streams.size());
+  EncodedFrame encoded;
+  auto encode_and_publish = [&](Frame const& frame, Region const* region, unsigned int stream) {
+    encoded.timestamp = frame.timestamp;
+    encoded.stream = stream;
+    encoded.encode_started = steady_clock::now();
+    auto status = region ? encoder.encode(frame, *region, &encoded.payload) : encoder.encode(frame, &encoded.payload);
+    if (status.code() != StatusCode::OK)
+      return;
+    encoded.encode_time_ms = duration<double, std::milli>(steady_clock::now() - encoded.encode_started).count();
+    this->counters.stages.record(Stage::ENCODE, encoded.encode_started);
+    this->publish(encoded);
+  };
+  for (;;) {
+    this->apply_configurations();
+    this->refresh_automatic();
+    if (driver->grab_frame(&pyramid[0]).code() != StatusCode::OK)
+      continue;
+    encoded.acquired = steady_clock::now();
+    encoded.traced = this->sampler->sample();
+    for (std::size_t level = 1; level < pyramid.size(); ++level) {
+      auto started = steady_clock::now();
+      downscale(pyramid[level - 1], &pyramid[level], &this->counters.allocations);
+      this->counters.stages.record(Stage::DOWNSCALE, started);
+    }
+    for (std::size_t level = 0; level < pyramid.size(); ++level) {
+      if (this->level_streams[level] >= 0)
+        encode_and_publish(pyramid[level], nullptr, this->level_streams[level]);
+    }
+    for (std::size_t crop = 0; crop < this->crops.size(); ++crop) {
+      encode_and_publish(pyramid[0], &this->crops[crop], this->crop_streams[crop]);
+    }
+  }
+}
+
+std::size_t CameraGateway::streams() const {
+  return this->level_streams.size() + this->crops.size();
+}
+
+void CameraGateway::attach(EncoderPool* encoders, PipelineOptions const& pipeline) {
+  auto encode_depth = pipeline.encode_depth() > 0 ? pipeline.encode_depth() : 2;
+  auto publish_depth = pipeline.publish_depth() > 0 ? pipeline.publish_depth() : 2;
+  // depths count captures, every stream of a capture has to fit for KEEP_LATEST to keep it whole
+  this->encoded = std::make_unique<BoundedQueue<EncodedFrame>>(publish_depth * this->streams());
+  this->source = encoders->add_source(&this->encoder, encode_depth * this->streams(), this->encoded.get(),
+                                      pipeline.overflow(), &this->dropped, &this->counters.stages);
+}
+
+void CameraGateway::capture(EncoderPool* encoders, BufferPool<std::shared_ptr<Frame>>* frames) {
+  // levels handed to the encoders are refilled from the pool, intermediate ones keep their buffer
+  std::vector<GrabbedFrame> pyramid(this->level_streams.size());
+  for (uint64_t capture = 0;; ++capture) {
+    this->apply_configurations();
+    this->refresh_automatic();
+    for (auto& level : pyramid) {
+      if (!level.frame)
+        level.frame = frames->acquire();
+      if (!level.frame)
+        level.frame = std::make_shared<Frame>();
+    }
+    if (driver->grab_frame(pyramid[0].frame.get()).code() != StatusCode::OK)
+      continue;
+    auto acquired = steady_clock::now();
+    auto traced = this->sampler->sample();
+    for (std::size_t level = 1; level < pyramid.size(); ++level) {
+      auto started = steady_clock::now();
+      downscale(*pyramid[level - 1].frame, pyramid[level].frame.get(), &this->counters.allocations);
+      this->counters.stages.record(Stage::DOWNSCALE, started);
+    }
+    // crops hold the captured frame itself, it is recycled once the last of them is encoded
+    for (std::size_t crop = 0; crop < this->crops.size(); ++crop) {
+      GrabbedFrame grabbed;
+      grabbed.capture = capture;
+      grabbed.stream = this->crop_streams[crop];
+      grabbed.frame = pyramid[0].frame;
+      grabbed.region = this->crops[crop];
+      grabbed.acquired = acquired;
+      grabbed.traced = traced;
+      encoders->submit(this->source, std::move(grabbed));
     }
+    for (std::size_t level = 0; level < pyramid.size(); ++level) {
+      if (this->level_streams[level] < 0)
+        continue;
+      pyramid[level].capture = capture;
+      pyramid[level].stream = this->level_streams[level];
+      pyramid[level].acquired = acquired;
+      pyramid[level].traced = traced;
+      encoders->submit(this->source, std::move(pyramid[level]));
+    }
+  }
+}
 
-    auto maybe_msg = channel.consume_for(seconds(0));
-    if (maybe_msg) {
-      provider.serve(*maybe_msg);
+void CameraGateway::publish(BufferPool<std::string>* payloads) {
+  for (;;) {
+    EncodedFrame encoded_frame;
+    this->encoded->pop(&encoded_frame);
+    this->publish(encoded_frame);
+    payloads->release(std::move(encoded_frame.payload));
+  }
+}
+
+void run(std::vector<CameraGateway*> const& gateways, CameraGatewayOptions const& options) {
+  auto& uri = options.broker_uri();
+  is::info("Trying to connect to {}", uri);
+  auto channel = is::Channel(uri);
+  std::mutex channel_mutex;
+
+  ZipkinOtTracerOptions zp_options;
+  zp_options.service_name =
+      gateways.size() == 1 ? fmt::format("CameraGateway.{}", gateways.front()->camera_id()) : "CameraGateway";
+  zp_options.collector_host = options.zipkin_host();
+  zp_options.collector_port = options.zipkin_port();
+  auto tracer = makeZipkinOtTracer(zp_options);
+  channel.set_tracer(tracer);
+
+  std::unique_ptr<PrometheusExporter> exporter;
+  if (options.prometheus_port() > 0)
+    exporter = std::make_unique<PrometheusExporter>(options.prometheus_port());
+
+  GatewayContext context{&channel, &channel_mutex, tracer, exporter.get()};
+  for (auto gateway : gateways) {
+    auto id = gateway->camera_id();
+    auto pos = std::find_if(options.cameras().begin(), options.cameras().end(),
+                            [&](auto const& camera) { return camera.camera_id() == static_cast<int>(id); });
+    gateway->open(options, pos != options.cameras().end() ? pos->initial_config() : options.initial_config(),
+                  context);
+  }
+
+  // RPCs of each camera get a connection and thread of their own, so they are neither delayed by nor
+  // delay the frames, and a SetConfig waiting for the next frame of a slow camera holds no other one
+  std::vector<std::thread> rpcs;
+  for (auto gateway : gateways) {
+    rpcs.emplace_back([gateway, uri, tracer] {
+      auto rpc_channel = is::Channel(uri);
+      rpc_channel.set_tracer(tracer);
+      auto provider = is::ServiceProvider(rpc_channel);
+      auto log_interceptor = is::LogInterceptor();
+      provider.add_interceptor(log_interceptor);
+      gateway->serve(&provider);
+      for (;;) {
+        provider.serve(rpc_channel.consume());
+      }
+    });
+  }
+
+  auto& pipeline = options.pipeline();
+  std::vector<std::thread> threads;
+  is::info("Starting to capture");
+  if (!pipeline.enabled()) {
+    if (pipeline.overflow() != OverflowPolicy::BLOCK)
+      is::warn("Overflow policy {} only applies to the pipelined mode", OverflowPolicy_Name(pipeline.overflow()));
+    for (auto gateway : gateways) {
+      gateway->start_capture();
+      threads.emplace_back([gateway] { gateway->capture(); });
     }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  auto encode_depth = pipeline.encode_depth() > 0 ? pipeline.encode_depth() : 2;
+  auto encode_occupancy =
+      pipeline.encode_occupancy() > 0 ? pipeline.encode_occupancy() : std::max(std::thread::hardware_concurrency(), 1u);
+  auto publish_depth = pipeline.publish_depth() > 0 ? pipeline.publish_depth() : 2;
+  is::info("Pipeline: encode_depth={} encode_occupancy={} publish_depth={} overflow={}", encode_depth,
+           encode_occupancy, publish_depth, OverflowPolicy_Name(pipeline.overflow()));
+
+  // every buffer that can be in flight at once: queued, being worked on, or parked for reordering
+  std::size_t frames_in_flight = 0, payloads_in_flight = 0;
+  for (auto gateway : gateways) {
+    frames_in_flight += (encode_depth + encode_occupancy + 1) * gateway->streams();
+    payloads_in_flight += 2 * encode_occupancy + (publish_depth + 1) * gateway->streams();
+  }
+  BufferPool<std::shared_ptr<Frame>> frame_buffers(frames_in_flight);
+  BufferPool<std::string> payload_buffers(payloads_in_flight);
+  // one set of workers for every camera, each camera gets its turn
+  EncoderPool encoders(encode_occupancy, &frame_buffers, &payload_buffers);
+  for (auto gateway : gateways) {
+    gateway->attach(&encoders, pipeline);
+  }
+  encoders.start();
+
+  for (auto gateway : gateways) {
+    gateway->start_capture();
+    threads.emplace_back([gateway, &encoders, &frame_buffers] { gateway->capture(&encoders, &frame_buffers); });
+    threads.emplace_back([gateway, &payload_buffers] { gateway->publish(&payload_buffers); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
   }
 }
 
 }  // namespace camera
-}  // namespace is
\ No newline at end of file
+}  // namespace is
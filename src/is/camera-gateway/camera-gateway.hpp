@@ -1,8 +1,14 @@
 #ifndef __IS_CAMERA_GATEWAY_HPP__
 #define __IS_CAMERA_GATEWAY_HPP__
 
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <google/protobuf/empty.pb.h>
 #include <is/msgs/camera.pb.h>
@@ -12,6 +18,15 @@
 #include <is/wire/core/status.hpp>
 #include <is/wire/rpc.hpp>
 #include <is/wire/rpc/log-interceptor.hpp>
+#include <zipkin/opentracing.h>
+#include "compression-controller.hpp"
+#include "conf/metrics.pb.h"
+#include "conf/options.pb.h"
+#include "encoder-pool.hpp"
+#include "metrics-exporter.hpp"
+#include "shared-memory-ring.hpp"
+#include "trace-sampler.hpp"
+#include "is/camera-drivers/encoder/encoder.hpp"
 #include "is/camera-drivers/interface/camera-driver.hpp"
 
 #define is_assert_set(failable)                    \
@@ -38,18 +53,100 @@ namespace camera {
 using namespace is::common;
 using namespace is::vision;
 
+// What the gateways of the process share. is::Channel is not thread safe, whoever publishes on
+// 'channel' holds 'channel_mutex'.
+struct GatewayContext {
+  is::Channel* channel = nullptr;
+  std::mutex* channel_mutex = nullptr;
+  std::shared_ptr<opentracing::Tracer> tracer;
+  PrometheusExporter* exporter = nullptr;  // optional
+};
+
+// Gateway of a single camera, under the CameraGateway.{id} namespace.
 struct CameraGateway {
-  CameraGateway(CameraDriver* impl);
-  void run(std::string const& uri, unsigned int const& id, std::string const& zipkin_host, uint32_t const& zipkin_port,
-           is::vision::CameraConfig const& initial_config);
+  CameraGateway(CameraDriver* impl, unsigned int id);
+  unsigned int camera_id() const { return this->id; }
+  void set_jpeg_options(JpegOptions const& options);
+  void set_raw_output(bool raw);
+  Status set_compression_target(CompressionTarget const& target);
+
+  // Applies the initial configuration and sets up the streams, topics and metrics of the camera.
+  void open(CameraGatewayOptions const& options, CameraConfig const& initial_config, GatewayContext const& context);
+  // Registers the RPCs of the camera.
+  void serve(is::ServiceProvider* provider);
+  void start_capture();
+  // Number of frames handed to the encoders per capture.
+  std::size_t streams() const;
+
+  // Captures, encodes and publishes on the calling thread, never returns.
+  void capture();
+  // Pipelined mode: frames are encoded by 'encoders' and published from a thread of their own.
+  void attach(EncoderPool* encoders, PipelineOptions const& pipeline);
+  void capture(EncoderPool* encoders, BufferPool<std::shared_ptr<Frame>>* frames);
+  void publish(BufferPool<std::string>* payloads);
 
  private:
   Status set_configuration(CameraConfig const& config);
   Status get_configuration(FieldSelector const& field_selector, CameraConfig* camera_config);
+  // Reads from the camera, with driver_mutex held
+  Status read_configuration(FieldSelector const& field_selector, CameraConfig* camera_config);
+  void update_shadow(FieldSelector const& field_selector);
+  // Reads back the settings under automatic control once 'refresh_period' went by, on the capture thread
+  void refresh_automatic();
+  // SetConfig runs on the RPC thread but is applied by the capture thread between two frames
+  Status enqueue_configuration(CameraConfig const& config);
+  void apply_configurations();
+  void publish(EncodedFrame const& frame);
 
+  unsigned int id;
   CameraDriver* driver;
+  FrameCounters counters;  // of this camera only, whatever other cameras share the process
+  FrameEncoder encoder;
+  CompressionController controller;
+  std::mutex driver_mutex;  // held around every use of the driver but grabbing frames
+  bool capturing;
+  // what GetConfig replies, the last configuration read from the camera
+  std::mutex shadow_mutex;
+  CameraConfig shadow;
+  ConfigFreshness freshness;
+  std::chrono::milliseconds refresh_period;
+  std::chrono::steady_clock::time_point last_refresh;
+
+  std::mutex commands_mutex;
+  std::deque<std::packaged_task<Status()>> commands;
+
+  GatewayContext context;
+  // streams are numbered in frame_topics, first the pyramid levels asked for and then the crops
+  std::vector<std::string> frame_topics;
+  std::vector<int> level_streams;  // per pyramid level, -1 for levels only computed for the next one
+  std::vector<Region> crops;
+  std::vector<unsigned int> crop_streams;
+  std::string timestamp_topic;
+  std::unique_ptr<SharedMemoryRing> ring;
+  std::vector<std::string> shared_topics;  // per stream, where descriptors of frames in the ring go
+  std::vector<bool> ring_warned;           // per stream, once a frame did not fit in a slot
+  SharedFrame shared_frame;
+  std::string descriptor;
+  std::unique_ptr<TraceSampler> sampler;
+
+  // touched only by the thread publishing the frames of the camera
+  std::string metrics_topic;
+  std::chrono::milliseconds late_after;
+  std::atomic<uint64_t> dropped;
+  CameraGatewayMetrics metrics;
+  std::chrono::steady_clock::time_point last_metrics;
+  std::chrono::steady_clock::time_point last_report;
+  StageReport stages;
+
+  unsigned int source;  // in the encoder pool
+  std::unique_ptr<BoundedQueue<EncodedFrame>> encoded;
 };
 
+// Runs the gateways of every camera of the process, over one broker connection for the frames and
+// another for the RPCs of each camera, each camera with its own capture and RPC threads. When the
+// pipeline is enabled, the encoders are shared by all cameras. Never returns.
+void run(std::vector<CameraGateway*> const& gateways, CameraGatewayOptions const& options);
+
 }  // namespace camera
 }  // namespace is
 
@@ -0,0 +1,107 @@
+#include "compression-controller.hpp"
+#include <algorithm>
+#include <cmath>
+#include "is/camera-drivers/utils/utils.hpp"
+
+namespace is {
+namespace camera {
+
+namespace {
+
+constexpr double smoothing = 0.2;
+constexpr double gain = 0.05;
+constexpr float min_compression = 0.01f;
+
+double average(double current, double sample) {
+  return current > 0.0 ? current + smoothing * (sample - current) : sample;
+}
+
+}  // namespace
+
+CompressionController::CompressionController(FrameEncoder* encoder)
+    : encoder(encoder),
+      compression(-1.0f),
+      frame_bytes(0),
+      frame_interval(0),
+      encode_time(0),
+      last_capture(0),
+      capture_bytes(0),
+      capture_time(0) {}
+
+Status CompressionController::set_target(CompressionTarget const& target) {
+  if (target.bytes_per_second() > 0 && target.encode_time_ms() > 0) {
+    auto why = "Only one of bytes_per_second and encode_time_ms can be set";
+    return internal_error(StatusCode::INVALID_ARGUMENT, why);
+  }
+  if (target.encode_time_ms() < 0) {
+    auto why = fmt::format("Target encode time equals to {} is out of range. Must be >= 0", target.encode_time_ms());
+    return internal_error(StatusCode::OUT_OF_RANGE, why);
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->current_target = target;
+  if (target.bytes_per_second() == 0 && target.encode_time_ms() == 0) {
+    this->compression = -1.0f;
+    this->encoder->set_adapted_compression(this->compression);
+  }
+  return is::make_status(StatusCode::OK);
+}
+
+CompressionTarget CompressionController::target() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->current_target;
+}
+
+void CompressionController::update(std::size_t size, double encode_time_ms, pb::Timestamp const& timestamp) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto capture = timestamp.seconds() + timestamp.nanos() / 1e9;
+  if (capture == this->last_capture) {
+    this->capture_bytes += size;
+    this->capture_time += encode_time_ms;
+    return;
+  }
+  if (this->last_capture > 0) {
+    if (capture > this->last_capture)
+      this->frame_interval = average(this->frame_interval, capture - this->last_capture);
+    this->frame_bytes = average(this->frame_bytes, this->capture_bytes);
+    this->encode_time = average(this->encode_time, this->capture_time);
+    this->adjust();
+  }
+  this->last_capture = capture;
+  this->capture_bytes = size;
+  this->capture_time = encode_time_ms;
+}
+
+void CompressionController::adjust() {
+  double achieved, goal, direction;
+  if (this->current_target.bytes_per_second() > 0) {
+    if (this->frame_interval <= 0)
+      return;
+    achieved = this->frame_bytes / this->frame_interval;
+    goal = this->current_target.bytes_per_second();
+    direction = this->encoder->compression_grows_payload() ? 1.0 : -1.0;
+  } else if (this->current_target.encode_time_ms() > 0) {
+    achieved = this->encode_time;
+    goal = this->current_target.encode_time_ms();
+    direction = 1.0;
+  } else {
+    return;
+  }
+  if (achieved <= 0)
+    return;
+
+  if (this->compression < 0)
+    this->compression = this->encoder->compression();
+  auto step = gain * direction * std::log(goal / achieved);
+  this->compression = std::max(min_compression, std::min(1.0f, static_cast<float>(this->compression + step)));
+  this->encoder->set_adapted_compression(this->compression);
+}
+
+void CompressionController::fill(CameraGatewayMetrics* metrics) const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  metrics->set_bytes_per_second(this->frame_interval > 0 ? this->frame_bytes / this->frame_interval : 0);
+  metrics->set_encode_time_ms(this->encode_time);
+  metrics->set_compression(this->encoder->compression());
+}
+
+}  // namespace camera
+}  // namespace is
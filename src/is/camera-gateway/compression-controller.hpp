@@ -0,0 +1,49 @@
+#ifndef __IS_COMPRESSION_CONTROLLER_HPP__
+#define __IS_COMPRESSION_CONTROLLER_HPP__
+
+#include <mutex>
+#include "conf/metrics.pb.h"
+#include "conf/options.pb.h"
+#include "is/camera-drivers/encoder/encoder.hpp"
+
+namespace is {
+namespace camera {
+
+// Adjusts the compression level of the encoder on every published frame to hold a CompressionTarget.
+// The error is taken in log scale, so the step is the same whether the target is missed by a factor
+// of two above or below, and the gain is kept low since frames already in the pipeline were encoded
+// with older levels.
+class CompressionController {
+ public:
+  explicit CompressionController(FrameEncoder* encoder);
+
+  Status set_target(CompressionTarget const& target);
+  CompressionTarget target() const;
+
+  // Accounts a frame captured at 'timestamp', 'size' bytes long after 'encode_time_ms' of encoding.
+  // Simulcast levels of the same capture add up, and are accounted once the next capture arrives.
+  void update(std::size_t size, double encode_time_ms, pb::Timestamp const& timestamp);
+  void fill(CameraGatewayMetrics* metrics) const;
+
+ private:
+  void adjust();
+
+  FrameEncoder* encoder;
+
+  mutable std::mutex mutex;
+  CompressionTarget current_target;
+  float compression;
+  // moving averages per capture
+  double frame_bytes;
+  double frame_interval;
+  double encode_time;
+  // capture being accounted
+  double last_capture;
+  double capture_bytes;
+  double capture_time;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_COMPRESSION_CONTROLLER_HPP__
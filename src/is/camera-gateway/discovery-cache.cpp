@@ -0,0 +1,78 @@
+#include "discovery-cache.hpp"
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <google/protobuf/util/json_util.h>
+#include <is/wire/core/logger.hpp>
+
+namespace is {
+namespace camera {
+
+DiscoveryCache::DiscoveryCache(std::string const& path) : path(path) {
+  if (this->path.empty())
+    return;
+  std::ifstream file(this->path);
+  if (!file)
+    return;
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  auto status = google::protobuf::util::JsonStringToMessage(buffer.str(), &this->cameras);
+  if (!status.ok()) {
+    is::warn("[DiscoveryCache] Ignoring '{}': {}", this->path, status.ToString());
+    this->cameras.Clear();
+  }
+}
+
+bool DiscoveryCache::find(std::string const& ip, CameraDrivers* driver, CameraInfo* info) const {
+  auto const& cameras = this->cameras.cameras();
+  auto pos = std::find_if(cameras.begin(), cameras.end(), [&](auto& c) { return c.ip_address() == ip; });
+  if (pos == cameras.end())
+    return false;
+  *driver = pos->driver();
+  info->Clear();
+  info->mutable_ethernet()->set_ip_address(pos->ip_address());
+  info->set_serial_number(pos->serial_number());
+  info->set_model_name(pos->model_name());
+  return true;
+}
+
+void DiscoveryCache::store(CameraDrivers driver, CameraInfo const& info) {
+  if (!info.has_ethernet())
+    return;
+  auto cameras = this->cameras.mutable_cameras();
+  auto pos = std::find_if(cameras->begin(), cameras->end(),
+                          [&](auto& c) { return c.ip_address() == info.ethernet().ip_address(); });
+  auto camera = pos != cameras->end() ? &(*pos) : this->cameras.add_cameras();
+  camera->set_ip_address(info.ethernet().ip_address());
+  camera->set_driver(driver);
+  camera->set_serial_number(info.serial_number());
+  camera->set_model_name(info.model_name());
+}
+
+void DiscoveryCache::save() const {
+  if (this->path.empty())
+    return;
+  std::string json;
+  google::protobuf::util::JsonPrintOptions options;
+  options.add_whitespace = true;
+  google::protobuf::util::MessageToJsonString(this->cameras, &json, options);
+  // written aside and renamed, so a crash or another gateway never leaves a partial file behind
+  auto temporary = fmt::format("{}.{}.tmp", this->path, getpid());
+  {
+    std::ofstream file(temporary, std::ios::trunc);
+    if (!(file << json)) {
+      is::warn("[DiscoveryCache] Failed to write '{}'", temporary);
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), this->path.c_str()) != 0) {
+    is::warn("[DiscoveryCache] Failed to replace '{}'", this->path);
+    std::remove(temporary.c_str());
+  }
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,31 @@
+#ifndef __IS_DISCOVERY_CACHE_HPP__
+#define __IS_DISCOVERY_CACHE_HPP__
+
+#include <string>
+#include "conf/options.pb.h"
+#include "is/camera-drivers/interface/camera-driver.hpp"
+
+namespace is {
+namespace camera {
+
+// Cameras found by previous enumerations, keyed by IP, see CameraGatewayOptions.discovery_cache.
+// A missing or unreadable file is an empty cache, and an empty path disables it. Only what connecting
+// needs is kept, see DiscoveredCamera: the CameraInfo given by find has the IP address, serial number
+// and model name set, the rest of what enumerating finds (mask, MAC address, link speed) is left out.
+class DiscoveryCache {
+ public:
+  explicit DiscoveryCache(std::string const& path);
+
+  bool find(std::string const& ip, CameraDrivers* driver, CameraInfo* info) const;
+  void store(CameraDrivers driver, CameraInfo const& info);
+  void save() const;
+
+ private:
+  std::string path;
+  DiscoveredCameras cameras;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_DISCOVERY_CACHE_HPP__
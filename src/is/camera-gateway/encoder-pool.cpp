@@ -0,0 +1,157 @@
+#include "encoder-pool.hpp"
+
+namespace is {
+namespace camera {
+
+namespace {
+
+// Which queued frames a new frame of 'capture' evicts on top of the oldest one of a full queue.
+auto superseded_by(OverflowPolicy policy, uint64_t capture) {
+  auto keep_latest = policy == OverflowPolicy::KEEP_LATEST;
+  return [keep_latest, capture](auto const& queued) { return keep_latest && queued.capture != capture; };
+}
+
+}  // namespace
+
+EncoderPool::Source::Source(FrameEncoder const* encoder, std::size_t depth, BoundedQueue<EncodedFrame>* output,
+                            OverflowPolicy policy, std::atomic<uint64_t>* dropped, StageLatencies* stages,
+                            uint64_t window)
+    : encoder(encoder),
+      input(depth),
+      output(output),
+      policy(policy),
+      dropped(dropped),
+      stages(stages),
+      taken(0),
+      next_sequence(0),
+      pending(window),
+      ready(window, 0) {}
+
+EncoderPool::EncoderPool(unsigned int workers, BufferPool<std::shared_ptr<Frame>>* frames,
+                         BufferPool<std::string>* payloads)
+    : workers_count(std::max(workers, 1u)),
+      frames(frames),
+      payloads(payloads),
+      window(2 * workers_count),
+      next_source(0) {}
+
+unsigned int EncoderPool::add_source(FrameEncoder const* encoder, std::size_t depth,
+                                     BoundedQueue<EncodedFrame>* output, OverflowPolicy policy,
+                                     std::atomic<uint64_t>* dropped, StageLatencies* stages) {
+  this->sources.emplace_back(new Source(encoder, depth, output, policy, dropped, stages, this->window));
+  return this->sources.size() - 1;
+}
+
+void EncoderPool::start() {
+  for (unsigned int i = 0; i < this->workers_count; ++i) {
+    this->workers.emplace_back([this] { this->work(); });
+  }
+}
+
+void EncoderPool::submit(unsigned int source, GrabbedFrame&& frame) {
+  auto& into = *this->sources[source];
+  if (into.policy == OverflowPolicy::BLOCK)
+    into.input.push(std::move(frame));
+  else
+    into.input.push_evicting(std::move(frame), superseded_by(into.policy, frame.capture),
+                             [&](GrabbedFrame&& dropped) { this->drop(into, std::move(dropped)); });
+  // taking the lock orders the push before a worker that just found every queue empty goes to sleep
+  { std::lock_guard<std::mutex> lock(this->take_mutex); }
+  this->submitted.notify_one();
+}
+
+void EncoderPool::release(std::shared_ptr<Frame>&& frame) {
+  // two crops finishing together may both see the other one holding the frame, it is then freed
+  // instead of recycled, which costs an allocation but never hands out a frame still in use
+  if (frame.use_count() == 1)
+    this->frames->release(std::move(frame));
+  else
+    frame.reset();
+}
+
+void EncoderPool::drop(Source& source, GrabbedFrame&& frame) {
+  this->release(std::move(frame.frame));
+  ++*source.dropped;
+}
+
+void EncoderPool::drop(EncodedFrame&& frame) {
+  this->payloads->release(std::move(frame.payload));
+  ++*this->sources[frame.source]->dropped;
+}
+
+unsigned int EncoderPool::take(GrabbedFrame* frame) {
+  std::unique_lock<std::mutex> lock(this->take_mutex);
+  for (;;) {
+    for (std::size_t i = 0; i < this->sources.size(); ++i) {
+      auto index = (this->next_source + i) % this->sources.size();
+      auto& source = *this->sources[index];
+      if (source.input.try_pop(frame)) {
+        frame->sequence = source.taken++;
+        this->next_source = index + 1;
+        return index;
+      }
+    }
+    this->submitted.wait(lock);
+  }
+}
+
+void EncoderPool::work() {
+  for (;;) {
+    GrabbedFrame grabbed;
+    auto index = this->take(&grabbed);
+    auto& source = *this->sources[index];
+    {
+      std::unique_lock<std::mutex> lock(source.mutex);
+      source.in_window.wait(lock, [&] { return grabbed.sequence < source.next_sequence + this->window; });
+    }
+
+    EncodedFrame encoded;
+    encoded.payload = this->payloads->acquire();
+    encoded.timestamp = grabbed.frame->timestamp;
+    encoded.source = index;
+    encoded.capture = grabbed.capture;
+    encoded.traced = grabbed.traced;
+    encoded.stream = grabbed.stream;
+    encoded.acquired = grabbed.acquired;
+    auto started = std::chrono::steady_clock::now();
+    encoded.encode_started = started;
+    auto status = grabbed.region.width > 0
+                      ? source.encoder->encode(*grabbed.frame, grabbed.region, &encoded.payload)
+                      : source.encoder->encode(*grabbed.frame, &encoded.payload);
+    if (status.code() != StatusCode::OK)
+      encoded.payload.clear();
+    encoded.encode_time_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    source.stages->record(Stage::ENCODE, started);
+    this->release(std::move(grabbed.frame));
+    this->deliver(index, grabbed.sequence, std::move(encoded));
+  }
+}
+
+void EncoderPool::deliver(unsigned int index, uint64_t sequence, EncodedFrame&& frame) {
+  auto& source = *this->sources[index];
+  std::unique_lock<std::mutex> lock(source.mutex);
+  source.pending[sequence % this->window] = std::move(frame);
+  source.ready[sequence % this->window] = 1;
+  // the worker that completes the oldest frame flushes every frame that became in order
+  for (;;) {
+    auto slot = source.next_sequence % this->window;
+    if (!source.ready[slot])
+      break;
+    auto& first = source.pending[slot];
+    if (first.payload.empty())
+      this->payloads->release(std::move(first.payload));
+    else if (source.policy == OverflowPolicy::BLOCK)
+      source.output->push(std::move(first));
+    else
+      source.output->push_evicting(std::move(first), superseded_by(source.policy, first.capture),
+                                   [this](EncodedFrame&& dropped) { this->drop(std::move(dropped)); });
+    source.ready[slot] = 0;
+    ++source.next_sequence;
+  }
+  lock.unlock();
+  source.in_window.notify_all();
+}
+
+}  // namespace camera
+}  // namespace is
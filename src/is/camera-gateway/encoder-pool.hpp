@@ -0,0 +1,116 @@
+#ifndef __IS_ENCODER_POOL_HPP__
+#define __IS_ENCODER_POOL_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bounded-queue.hpp"
+#include "buffer-pool.hpp"
+#include "conf/options.pb.h"
+#include "is/camera-drivers/encoder/encoder.hpp"
+#include "is/camera-drivers/utils/latency-histogram.hpp"
+
+namespace is {
+namespace camera {
+
+struct GrabbedFrame {
+  uint64_t sequence;  // assigned by EncoderPool
+  uint64_t capture = 0;  // shared by every stream of the same frame grabbed from the camera
+  bool traced = false;   // decided once per capture, see TraceSampler
+  unsigned int stream = 0;  // which simulcast level or region, 0 is the full frame
+  // shared by the crops of the same capture, goes back to the pool with the last of them
+  std::shared_ptr<Frame> frame;
+  Region region;  // encoded instead of the whole frame when not empty
+  std::chrono::steady_clock::time_point acquired;  // when the driver handed the frame over
+};
+
+struct EncodedFrame {
+  std::string payload;  // serialized is::vision::Image
+  pb::Timestamp timestamp;
+  unsigned int source = 0;  // camera it came from, see EncoderPool::add_source
+  uint64_t capture = 0;
+  bool traced = false;
+  unsigned int stream = 0;
+  std::chrono::steady_clock::time_point acquired;
+  std::chrono::steady_clock::time_point encode_started;
+  double encode_time_ms = 0;
+};
+
+// Encodes consecutive frames concurrently, one frame per worker, and hands them to an output
+// queue in capture order. Workers never wait on each other: a frame that finishes early is parked
+// in a reorder buffer until the frames before it are delivered. Frame buffers go back to 'frames'
+// once encoded and payloads are taken from 'payloads', the publisher is expected to release them.
+//
+// Several cameras can share the workers, each one as a source with its own queues, overflow policy
+// and capture order. Workers take frames from the sources in turns, so a camera with a
+// higher frame rate or resolution can not starve the others. Unless a source's policy is BLOCK,
+// its full queue drops frames instead of throttling the stage before it. KEEP_LATEST drops whole
+// captures: a frame evicts the queued streams of older captures and never those of its own.
+class EncoderPool {
+ public:
+  EncoderPool(unsigned int workers, BufferPool<std::shared_ptr<Frame>>* frames, BufferPool<std::string>* payloads);
+
+  // Sources are all added before start, frames of a source are encoded by 'encoder' and go to 'output'.
+  // Drops are counted in 'dropped' and encoding times recorded in 'stages'.
+  unsigned int add_source(FrameEncoder const* encoder, std::size_t depth, BoundedQueue<EncodedFrame>* output,
+                          OverflowPolicy policy, std::atomic<uint64_t>* dropped, StageLatencies* stages);
+  void start();
+
+  // Number of payloads that can be parked in the reorder buffer of each source.
+  std::size_t reorder_window() const { return this->window; }
+
+  // With the BLOCK policy, blocks while 'depth' frames of the source are already waiting for a worker.
+  void submit(unsigned int source, GrabbedFrame&& frame);
+
+ private:
+  struct Source {
+    Source(FrameEncoder const* encoder, std::size_t depth, BoundedQueue<EncodedFrame>* output, OverflowPolicy policy,
+           std::atomic<uint64_t>* dropped, StageLatencies* stages, uint64_t window);
+
+    FrameEncoder const* encoder;
+    BoundedQueue<GrabbedFrame> input;
+    BoundedQueue<EncodedFrame>* output;
+    OverflowPolicy policy;
+    std::atomic<uint64_t>* dropped;
+    StageLatencies* stages;
+    // frames are numbered as they leave the input queue, so the ones dropped while queued leave no gap
+    uint64_t taken;
+
+    std::mutex mutex;
+    std::condition_variable in_window;
+    uint64_t next_sequence;
+    // one slot per sequence in the window, indexed by sequence % window
+    std::vector<EncodedFrame> pending;
+    std::vector<char> ready;
+  };
+
+  void work();
+  // Waits for a frame of any source, starting from the one after the last served.
+  unsigned int take(GrabbedFrame* frame);
+  void deliver(unsigned int source, uint64_t sequence, EncodedFrame&& frame);
+  void drop(Source& source, GrabbedFrame&& frame);
+  void drop(EncodedFrame&& frame);
+  void release(std::shared_ptr<Frame>&& frame);
+
+  unsigned int workers_count;
+  BufferPool<std::shared_ptr<Frame>>* frames;
+  BufferPool<std::string>* payloads;
+  // how far ahead of the oldest undelivered frame a worker may start, bounds the reorder buffers
+  uint64_t window;
+  std::vector<std::unique_ptr<Source>> sources;
+
+  std::mutex take_mutex;
+  std::condition_variable submitted;
+  unsigned int next_source;
+
+  std::vector<std::thread> workers;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_ENCODER_POOL_HPP__
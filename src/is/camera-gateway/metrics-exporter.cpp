@@ -0,0 +1,127 @@
+#include "metrics-exporter.hpp"
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <is/wire/core/logger.hpp>
+
+namespace is {
+namespace camera {
+
+void StageReport::fill(StageLatencies const& latencies, CameraGatewayMetrics* metrics) {
+  metrics->clear_stages();
+  for (std::size_t i = 0; i < stage_count; ++i) {
+    auto stage = static_cast<Stage>(i);
+    latencies[stage].snapshot(&this->current);
+    auto& previous = this->previous[i];
+    previous.resize(this->current.size(), 0);
+    uint64_t count = 0;
+    for (std::size_t bucket = 0; bucket < this->current.size(); ++bucket) {
+      count += this->current[bucket];
+      std::swap(previous[bucket], this->current[bucket]);
+      this->current[bucket] = previous[bucket] - this->current[bucket];
+    }
+    auto latency = metrics->add_stages();
+    latency->set_stage(stage_name(stage));
+    latency->set_p50_ms(LatencyHistogram::percentile(this->current, 0.5));
+    latency->set_p99_ms(LatencyHistogram::percentile(this->current, 0.99));
+    latency->set_p999_ms(LatencyHistogram::percentile(this->current, 0.999));
+    latency->set_count(count);
+  }
+}
+
+PrometheusExporter::PrometheusExporter(uint16_t port) {
+  auto server = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(server, 4) != 0) {
+    is::critical("[Prometheus] Failed to listen on port {}: {}", port, std::strerror(errno));
+  }
+  is::info("[Prometheus] Serving metrics on port {}", port);
+  std::thread([this, server] { this->serve(server); }).detach();
+}
+
+void PrometheusExporter::update(unsigned int camera, CameraGatewayMetrics const& metrics) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->cameras[camera] = metrics;
+}
+
+std::string PrometheusExporter::render() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::string text;
+  // samples of a family are listed together, one per camera
+  auto family = [&](char const* name, char const* type, double (*value)(CameraGatewayMetrics const&)) {
+    text += fmt::format("# TYPE {} {}\n", name, type);
+    for (auto const& camera : this->cameras) {
+      text += fmt::format("{}{{camera=\"{}\"}} {}\n", name, camera.first, value(camera.second));
+    }
+  };
+  family("camera_gateway_frames_delivered_total", "counter",
+         [](CameraGatewayMetrics const& m) -> double { return m.delivered(); });
+  family("camera_gateway_frames_dropped_total", "counter",
+         [](CameraGatewayMetrics const& m) -> double { return m.dropped(); });
+  family("camera_gateway_frames_late_total", "counter",
+         [](CameraGatewayMetrics const& m) -> double { return m.late(); });
+  family("camera_gateway_bytes_per_second", "gauge",
+         [](CameraGatewayMetrics const& m) -> double { return m.bytes_per_second(); });
+  family("camera_gateway_compression", "gauge",
+         [](CameraGatewayMetrics const& m) -> double { return m.compression(); });
+  family("camera_gateway_timestamp_residual_seconds", "gauge",
+         [](CameraGatewayMetrics const& m) -> double { return m.timestamp_residual_ms() / 1e3; });
+  family("camera_gateway_saved_writes_total", "counter",
+         [](CameraGatewayMetrics const& m) -> double { return m.saved_writes(); });
+  family("camera_gateway_ring_fallbacks_total", "counter",
+         [](CameraGatewayMetrics const& m) -> double { return m.ring_fallbacks(); });
+  text += "# TYPE camera_gateway_stage_latency_seconds summary\n";
+  for (auto const& camera : this->cameras) {
+    for (auto const& stage : camera.second.stages()) {
+      auto labels = fmt::format("camera=\"{}\",stage=\"{}\"", camera.first, stage.stage());
+      auto sample = [&](char const* quantile, double ms) {
+        text += fmt::format("camera_gateway_stage_latency_seconds{{{},quantile=\"{}\"}} {}\n", labels, quantile,
+                            ms / 1e3);
+      };
+      sample("0.5", stage.p50_ms());
+      sample("0.99", stage.p99_ms());
+      sample("0.999", stage.p999_ms());
+      text += fmt::format("camera_gateway_stage_latency_seconds_count{{{}}} {}\n", labels, stage.count());
+    }
+  }
+  return text;
+}
+
+void PrometheusExporter::serve(int server) {
+  char request[1024];
+  for (;;) {
+    auto client = accept(server, nullptr, nullptr);
+    if (client < 0)
+      continue;
+    // a client that stalls or goes away costs at most the timeout, never the exporter or the process
+    timeval timeout{5, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // whatever was asked for, the answer is the same
+    read(client, request, sizeof(request));
+    auto text = this->render();
+    auto response = fmt::format("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: {}\r\n\r\n{}",
+                                text.size(), text);
+    for (std::size_t sent = 0; sent < response.size();) {
+      auto n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    close(client);
+  }
+}
+
+}  // namespace camera
+}  // namespace is
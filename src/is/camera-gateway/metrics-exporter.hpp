@@ -0,0 +1,47 @@
+#ifndef __IS_METRICS_EXPORTER_HPP__
+#define __IS_METRICS_EXPORTER_HPP__
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "conf/metrics.pb.h"
+#include "is/camera-drivers/utils/latency-histogram.hpp"
+
+namespace is {
+namespace camera {
+
+// Percentiles of every stage over the frames recorded in 'latencies' since the previous call. Each
+// report follows the latencies of a single camera.
+class StageReport {
+ public:
+  void fill(StageLatencies const& latencies, CameraGatewayMetrics* metrics);
+
+ private:
+  std::vector<uint64_t> current;
+  std::array<std::vector<uint64_t>, stage_count> previous;
+};
+
+// Serves the last metrics of every camera as Prometheus text, to whoever connects to 'port'. The
+// server runs on a thread of its own for as long as the process, which never waits on a scrape.
+class PrometheusExporter {
+ public:
+  explicit PrometheusExporter(uint16_t port);
+
+  void update(unsigned int camera, CameraGatewayMetrics const& metrics);
+
+ private:
+  void serve(int server);
+  std::string render();
+
+  std::mutex mutex;
+  std::map<unsigned int, CameraGatewayMetrics> cameras;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_METRICS_EXPORTER_HPP__
@@ -1,7 +1,9 @@
 #include "is/camera-drivers/flycapture2/driver.hpp"
 #include "is/camera-drivers/spinnaker/driver.hpp"
 #include "is/camera-gateway/camera-gateway.hpp"
+#include "is/camera-gateway/discovery-cache.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <is/msgs/validate.hpp>
 #include "boost/variant.hpp"
@@ -22,46 +24,132 @@ CameraGatewayOptions load_options(int argc, char** argv) {
   return options;
 }
 
+StreamSettings make_stream_settings(StreamOptions const& options) {
+  StreamSettings settings;
+  switch (options.buffer_handling()) {
+  case StreamOptions::NEWEST_ONLY: settings.buffer_handling = "NewestOnly"; break;
+  case StreamOptions::NEWEST_FIRST: settings.buffer_handling = "NewestFirst"; break;
+  case StreamOptions::OLDEST_FIRST: settings.buffer_handling = "OldestFirst"; break;
+  case StreamOptions::OLDEST_FIRST_OVERWRITE: settings.buffer_handling = "OldestFirstOverwrite"; break;
+  default: break;
+  }
+  settings.buffer_count = options.buffer_count();
+  settings.packet_resend = !options.disable_packet_resend();
+  settings.packet_resend_timeout_ms = options.packet_resend_timeout_ms();
+  settings.packet_resend_max_requests = options.packet_resend_max_requests();
+  return settings;
+}
+
+std::unique_ptr<CameraDriver> make_driver(CameraDrivers driver, CameraGatewayOptions const& op) {
+  if (driver == CameraDrivers::FLYCAPTURE)
+    return std::make_unique<FlyCapture2Driver>(op.mode_cache());
+  return std::make_unique<SpinnakerDriver>(make_stream_settings(op.stream()));
+}
+
 int main(int argc, char** argv) {
+  auto started = std::chrono::steady_clock::now();
   auto op = load_options(argc, argv);
 
   cv::setNumThreads(op.parallelism());
   auto cdriver = op.camera_driver();
+  auto allowed = [&](CameraDrivers driver) {
+    return cdriver == CameraDrivers::NOT_SPECIFIED || cdriver == driver;
+  };
+
+  // Full enumeration is slow on multi-homed hosts, so it only runs when a camera isn't in the
+  // discovery cache or can't be reached through it.
+  DiscoveryCache cache(op.discovery_cache());
   std::vector<std::pair<CameraDrivers, CameraInfo>> cam_infos;
-  if (op.camera_driver() == CameraDrivers::NOT_SPECIFIED || op.camera_driver() == CameraDrivers::FLYCAPTURE) {
-    auto infos = FlyCapture2Driver::find_cameras();
-    std::transform(infos.begin(), infos.end(), std::back_inserter(cam_infos),
-                   [](auto& info) { return std::make_pair(CameraDrivers::FLYCAPTURE, info); });
-  }
-  if (op.camera_driver() == CameraDrivers::NOT_SPECIFIED || op.camera_driver() == CameraDrivers::SPINNAKER) {
-    auto infos = SpinnakerDriver::find_cameras();
-    std::transform(infos.begin(), infos.end(), std::back_inserter(cam_infos),
-                   [](auto& info) { return std::make_pair(CameraDrivers::SPINNAKER, info); });
-  }
+  bool enumerated = false;
+  auto enumerate = [&] {
+    if (enumerated)
+      return;
+    enumerated = true;
+    if (allowed(CameraDrivers::FLYCAPTURE)) {
+      auto infos = FlyCapture2Driver::find_cameras();
+      std::transform(infos.begin(), infos.end(), std::back_inserter(cam_infos),
+                     [](auto& info) { return std::make_pair(CameraDrivers::FLYCAPTURE, info); });
+    }
+    if (allowed(CameraDrivers::SPINNAKER)) {
+      auto infos = SpinnakerDriver::find_cameras();
+      std::transform(infos.begin(), infos.end(), std::back_inserter(cam_infos),
+                     [](auto& info) { return std::make_pair(CameraDrivers::SPINNAKER, info); });
+    }
+    for (auto& info : cam_infos) {
+      is::info("{} -> {}", CameraDrivers_Name(info.first), info.second);
+      cache.store(info.first, info.second);
+    }
+    cache.save();
+  };
 
-  for (auto& info : cam_infos) {
-    is::info("{} -> {}", CameraDrivers_Name(info.first), info.second);
+  if (op.cameras().empty()) {
+    auto camera = op.add_cameras();
+    camera->set_camera_ip(op.camera_ip());
+    camera->set_camera_id(op.camera_id());
+    *camera->mutable_initial_config() = op.initial_config();
   }
 
-  auto pos = std::find_if(cam_infos.begin(), cam_infos.end(),
-                          [&](auto& c) { return c.second.ethernet().ip_address() == op.camera_ip(); });
-  if (pos == cam_infos.end()) {
-    is::critical("Camera with IP {} not found.", op.camera_ip());
+  int cached = 0;
+  std::vector<std::unique_ptr<CameraDriver>> drivers;
+  std::vector<std::unique_ptr<CameraGateway>> gateways;
+  for (auto const& camera : op.cameras()) {
+    auto same_id = [&](auto& g) { return g->camera_id() == static_cast<unsigned int>(camera.camera_id()); };
+    if (std::any_of(gateways.begin(), gateways.end(), same_id)) {
+      is::critical("Camera id {} is used by more than one camera.", camera.camera_id());
+    }
+
+    is::info("Connecting to camera {}", camera.camera_ip());
+    std::unique_ptr<CameraDriver> driver;
+    CameraDrivers driver_type;
+    CameraInfo info;
+    if (cache.find(camera.camera_ip(), &driver_type, &info) && allowed(driver_type)) {
+      driver = make_driver(driver_type, op);
+      auto status = driver->connect(info);
+      if (status.code() == is::common::StatusCode::OK) {
+        ++cached;
+      } else {
+        is::warn("Cached camera {} unusable ({}), enumerating", camera.camera_ip(), status);
+        driver.reset();
+      }
+    }
+    if (!driver) {
+      enumerate();
+      auto pos = std::find_if(cam_infos.begin(), cam_infos.end(),
+                              [&](auto& c) { return c.second.ethernet().ip_address() == camera.camera_ip(); });
+      if (pos == cam_infos.end()) {
+        is::critical("Camera with IP {} not found.", camera.camera_ip());
+      }
+      driver = make_driver(pos->first, op);
+      auto status = driver->connect(pos->second);
+      if (status.code() != is::common::StatusCode::OK) {
+        is::critical("Failed to connect to camera {}: {}", camera.camera_ip(), status);
+      }
+    }
+    driver->set_packet_delay(op.packet_delay());
+    driver->set_packet_size(op.packet_size());
+    driver->reverse_x(op.reverse_x());
+    driver->reverse_y(op.reverse_y());
+    auto gateway = std::make_unique<CameraGateway>(driver.get(), camera.camera_id());
+    gateway->set_jpeg_options(op.jpeg());
+    gateway->set_raw_output(op.raw_output());
+    auto target = gateway->set_compression_target(op.compression_target());
+    if (target.code() != is::common::StatusCode::OK) {
+      is::critical("Invalid compression target for camera {}: {}", camera.camera_id(), target);
+    }
+    drivers.push_back(std::move(driver));
+    gateways.push_back(std::move(gateway));
   }
 
-  is::info("Connecting to camera {}", op.camera_ip());
-  std::unique_ptr<CameraDriver> driver;
-  if (pos->first == CameraDrivers::FLYCAPTURE)
-    driver = std::make_unique<FlyCapture2Driver>();
-  if (pos->first == CameraDrivers::SPINNAKER)
-    driver = std::make_unique<SpinnakerDriver>();
-  driver->connect(pos->second);
-  driver->set_packet_delay(op.packet_delay());
-  driver->set_packet_size(op.packet_size());
-  driver->reverse_x(op.reverse_x());
-  driver->reverse_y(op.reverse_y());
-  CameraGateway gateway(driver.get());
-  gateway.run(op.broker_uri(), op.camera_id(), op.zipkin_host(), op.zipkin_port(), op.initial_config());
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started);
+  // how much discovery Spinnaker did on its own is logged by the driver, this only tells what the cache saved
+  is::info("Connected to {} camera(s) in {:.0f} ms, {} found in the discovery cache{}", gateways.size(),
+           elapsed.count(), cached, enumerated ? ", the others through enumeration" : "");
+
+  std::vector<CameraGateway*> running;
+  for (auto& gateway : gateways) {
+    running.push_back(gateway.get());
+  }
+  run(running, op);
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include "shared-memory-ring.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <is/wire/core/logger.hpp>
+
+namespace is {
+namespace camera {
+
+namespace {
+
+constexpr uint32_t ring_magic = 0x49534652;  // "ISFR"
+constexpr std::size_t alignment = 64;
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t slots;
+  uint64_t slot_size;
+  std::atomic<uint64_t> sequence;  // last frame written
+};
+
+struct SlotHeader {
+  std::atomic<uint64_t> sequence;
+  uint64_t size;
+};
+
+std::size_t aligned(std::size_t size) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+std::size_t slot_offset(std::size_t slot_size, unsigned int slot) {
+  return aligned(sizeof(RingHeader)) + slot * (aligned(sizeof(SlotHeader)) + aligned(slot_size));
+}
+
+std::size_t data_offset(std::size_t slot_size, unsigned int slot) {
+  return slot_offset(slot_size, slot) + aligned(sizeof(SlotHeader));
+}
+
+}  // namespace
+
+SharedMemoryRing::SharedMemoryRing(std::string const& segment, unsigned int slots, std::size_t slot_size)
+    : segment(segment), slots(slots), slot_size(slot_size), length(slot_offset(slot_size, slots)), sequence(0) {
+  auto fd = shm_open(segment.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+    is::critical("[SharedMemory] Failed to open '{}': {}", segment, std::strerror(errno));
+  if (ftruncate(fd, this->length) != 0)
+    is::critical("[SharedMemory] Failed to resize '{}': {}", segment, std::strerror(errno));
+  auto memory = mmap(nullptr, this->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    is::critical("[SharedMemory] Failed to map '{}': {}", segment, std::strerror(errno));
+  this->memory = static_cast<unsigned char*>(memory);
+
+  for (unsigned int slot = 0; slot < slots; ++slot) {
+    auto header = new (this->memory + slot_offset(slot_size, slot)) SlotHeader;
+    header->sequence.store(0);
+    header->size = 0;
+  }
+  auto ring = new (this->memory) RingHeader;
+  ring->slots = slots;
+  ring->slot_size = slot_size;
+  ring->sequence.store(0);
+  // readers check the magic last, once everything else is in place
+  std::atomic_thread_fence(std::memory_order_release);
+  ring->magic = ring_magic;
+  is::info("[SharedMemory] Publishing frames through '{}', {} slots of {} bytes", segment, slots, slot_size);
+}
+
+SharedMemoryRing::~SharedMemoryRing() {
+  munmap(this->memory, this->length);
+  shm_unlink(this->segment.c_str());
+}
+
+bool SharedMemoryRing::write(std::string const& payload, pb::Timestamp const& timestamp, SharedFrame* frame) {
+  if (payload.size() > this->slot_size)
+    return false;
+
+  auto sequence = ++this->sequence;
+  auto slot = static_cast<unsigned int>(sequence % this->slots);
+  auto header = reinterpret_cast<SlotHeader*>(this->memory + slot_offset(this->slot_size, slot));
+  // mark the slot as busy before touching its data, so readers holding an older frame notice it
+  header->sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(this->memory + data_offset(this->slot_size, slot), payload.data(), payload.size());
+  header->size = payload.size();
+  header->sequence.store(sequence, std::memory_order_release);
+  reinterpret_cast<RingHeader*>(this->memory)->sequence.store(sequence, std::memory_order_release);
+
+  frame->set_segment(this->segment);
+  frame->set_slot(slot);
+  frame->set_sequence(sequence);
+  frame->set_offset(data_offset(this->slot_size, slot));
+  frame->set_size(payload.size());
+  *frame->mutable_timestamp() = timestamp;
+  return true;
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,38 @@
+#ifndef __IS_SHARED_MEMORY_RING_HPP__
+#define __IS_SHARED_MEMORY_RING_HPP__
+
+#include <cstdint>
+#include <string>
+#include "conf/shared-frame.pb.h"
+#include "is/camera-drivers/interface/camera-driver.hpp"
+
+namespace is {
+namespace camera {
+
+// Ring of frame payloads in a POSIX shared memory segment, for subscribers on the same host. Each
+// slot carries the sequence of the frame it holds, zero while it is being written, so any number
+// of readers can use a slot in place and check afterwards that the writer did not reuse it meanwhile.
+class SharedMemoryRing {
+ public:
+  SharedMemoryRing(std::string const& segment, unsigned int slots, std::size_t slot_size);
+  ~SharedMemoryRing();
+  SharedMemoryRing(SharedMemoryRing const&) = delete;
+  SharedMemoryRing& operator=(SharedMemoryRing const&) = delete;
+
+  // Copies 'payload' to the oldest slot and describes where it went in 'frame'. Returns false,
+  // leaving the ring untouched, when the payload is larger than a slot.
+  bool write(std::string const& payload, pb::Timestamp const& timestamp, SharedFrame* frame);
+
+ private:
+  std::string segment;
+  unsigned int slots;
+  std::size_t slot_size;
+  std::size_t length;
+  unsigned char* memory;
+  uint64_t sequence;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_SHARED_MEMORY_RING_HPP__
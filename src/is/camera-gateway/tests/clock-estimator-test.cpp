@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include "is/camera-drivers/utils/clock-estimator.hpp"
+
+namespace {
+
+using namespace is::camera;
+using namespace std::chrono;
+
+auto const start = system_clock::time_point(seconds(1600000000));
+auto const period = milliseconds(33);
+
+double error_ms(system_clock::time_point mapped, system_clock::time_point expected) {
+  return duration<double, std::milli>(mapped - expected).count();
+}
+
+TEST(ClockEstimator, MapsAFixedDelayExactly) {
+  ClockEstimator clock;
+  system_clock::time_point mapped;
+  for (int i = 0; i < 100; ++i) {
+    auto device_ns = uint64_t{5000000000} + i * uint64_t{33000000};
+    mapped = clock.update(device_ns, start + i * period + milliseconds(2));
+    EXPECT_NEAR(error_ms(mapped, start + i * period + milliseconds(2)), 0.0, 1e-3) << i;
+  }
+  EXPECT_NEAR(clock.residual_ms(), 0.0, 1e-3);
+}
+
+TEST(ClockEstimator, FollowsTheFastestArrivalsAndTheDrift) {
+  ClockEstimator clock;
+  std::mt19937 random(42);
+  std::exponential_distribution<double> jitter_ms(1.0);
+  // the camera clock runs 50 parts per million fast
+  double const drift = 1 + 50e-6;
+  double worst = 0.0;
+  for (int i = 0; i < 5000; ++i) {
+    auto happened = start + i * period;
+    auto device_ns = static_cast<uint64_t>(i * 33e6 * drift);
+    auto delay = duration<double, std::milli>(2 + jitter_ms(random));
+    auto mapped = clock.update(device_ns, happened + duration_cast<system_clock::duration>(delay));
+    if (i > 2000)
+      worst = std::max(worst, std::abs(error_ms(mapped, happened + milliseconds(2))));
+  }
+  // the floor sits on the luckiest recent arrivals, within a fraction of the jitter
+  EXPECT_LT(worst, 0.5);
+  EXPECT_GT(clock.residual_ms(), 0.5);
+}
+
+TEST(ClockEstimator, RestartsWhenTheCameraClockGoesBack) {
+  ClockEstimator clock;
+  for (int i = 0; i < 100; ++i) {
+    clock.update(uint64_t{9000000000} + i * uint64_t{33000000}, start + i * period);
+  }
+  // reset camera: its clock starts over, arrivals go on
+  auto arrival = start + 100 * period + milliseconds(7);
+  EXPECT_NEAR(error_ms(clock.update(1000, arrival), arrival), 0.0, 1e-3);
+  EXPECT_NEAR(error_ms(clock.update(1000 + 33000000, arrival + period), arrival + period), 0.0, 1e-3);
+}
+
+TEST(ClockEstimator, RestartsWhenTheCameraClockStepsBackSlightly) {
+  ClockEstimator clock;
+  for (int i = 0; i < 100; ++i) {
+    clock.update(uint64_t{9000000000} + i * uint64_t{33000000}, start + i * period);
+  }
+  // too close to the line to be told from jitter by distance alone
+  auto device_ns = uint64_t{9000000000} + 99 * uint64_t{33000000} - 10000000;
+  auto arrival = start + 100 * period;
+  EXPECT_NEAR(error_ms(clock.update(device_ns, arrival), arrival), 0.0, 1e-3);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
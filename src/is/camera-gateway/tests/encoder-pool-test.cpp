@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <set>
+#include <thread>
+#include "is/camera-gateway/encoder-pool.hpp"
+
+namespace {
+
+using namespace is::camera;
+using namespace std::chrono;
+
+unsigned int const streams = 3;
+
+// Workers never stop, so the pipeline outlives the test like it outlives the service.
+struct Pipeline {
+  explicit Pipeline(OverflowPolicy policy)
+      : frames(16), payloads(16), encoder(&counters), output(2 * streams), dropped(0), encoders(1, &frames, &payloads) {
+    this->encoder.set_raw(true);
+    this->source = this->encoders.add_source(&this->encoder, 2 * streams, &this->output, policy, &this->dropped,
+                                             &this->counters.stages);
+  }
+
+  void submit(uint64_t capture) {
+    auto frame = std::make_shared<Frame>();
+    frame->width = frame->height = frame->stride = 4;
+    frame->data.assign(16, static_cast<unsigned char>(capture));
+    for (unsigned int stream = 0; stream < streams; ++stream) {
+      GrabbedFrame grabbed;
+      grabbed.capture = capture;
+      grabbed.stream = stream;
+      grabbed.frame = frame;
+      if (stream > 0)
+        grabbed.region = Region{0, 0, 2, 2};
+      this->encoders.submit(this->source, std::move(grabbed));
+    }
+  }
+
+  // Waits until 'count' frames are ready to be published, without taking them.
+  bool wait_output(std::size_t count) {
+    auto deadline = steady_clock::now() + seconds(5);
+    while (this->output.size() < count) {
+      if (steady_clock::now() > deadline)
+        return false;
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+    return true;
+  }
+
+  std::vector<EncodedFrame> take(std::size_t count) {
+    std::vector<EncodedFrame> taken(count);
+    for (auto& frame : taken) {
+      if (!this->output.pop_for(&frame, seconds(5)))
+        ADD_FAILURE() << "expected " << count << " encoded frames";
+    }
+    return taken;
+  }
+
+  BufferPool<std::shared_ptr<Frame>> frames;
+  BufferPool<std::string> payloads;
+  FrameCounters counters;
+  FrameEncoder encoder;
+  BoundedQueue<EncodedFrame> output;
+  std::atomic<uint64_t> dropped;
+  EncoderPool encoders;
+  unsigned int source;
+};
+
+void expect_whole_capture(std::vector<EncodedFrame> const& frames, uint64_t capture) {
+  std::set<unsigned int> published;
+  for (auto const& frame : frames) {
+    EXPECT_EQ(frame.capture, capture);
+    EXPECT_FALSE(frame.payload.empty());
+    published.insert(frame.stream);
+  }
+  EXPECT_EQ(published.size(), streams);
+}
+
+TEST(EncoderPool, KeepLatestKeepsEveryStreamOfTheNewestCaptureWaitingToBeEncoded) {
+  auto pipeline = new Pipeline(OverflowPolicy::KEEP_LATEST);
+  for (uint64_t capture = 0; capture < 3; ++capture) {
+    pipeline->submit(capture);
+  }
+  pipeline->encoders.start();
+
+  expect_whole_capture(pipeline->take(streams), 2);
+  EncodedFrame late;
+  EXPECT_FALSE(pipeline->output.pop_for(&late, milliseconds(100)));
+  EXPECT_EQ(pipeline->dropped.load(), 2 * streams);
+}
+
+TEST(EncoderPool, KeepLatestKeepsEveryStreamOfTheNewestCaptureWaitingToBePublished) {
+  auto pipeline = new Pipeline(OverflowPolicy::KEEP_LATEST);
+  pipeline->encoders.start();
+  pipeline->submit(0);
+  ASSERT_TRUE(pipeline->wait_output(streams));
+  pipeline->submit(1);
+  // the streams of the first capture leave as soon as the first stream of the second one arrives
+  auto deadline = steady_clock::now() + seconds(5);
+  while (pipeline->dropped.load() < streams && steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  ASSERT_TRUE(pipeline->wait_output(streams));
+
+  expect_whole_capture(pipeline->take(streams), 1);
+  EXPECT_EQ(pipeline->dropped.load(), streams);
+}
+
+TEST(EncoderPool, DropOldestKeepsOlderCapturesWhileThereIsRoom) {
+  auto pipeline = new Pipeline(OverflowPolicy::DROP_OLDEST);
+  pipeline->submit(0);
+  pipeline->submit(1);
+  pipeline->encoders.start();
+
+  expect_whole_capture(pipeline->take(streams), 0);
+  expect_whole_capture(pipeline->take(streams), 1);
+  EXPECT_EQ(pipeline->dropped.load(), 0u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "is/camera-gateway/metrics-exporter.hpp"
+
+namespace {
+
+using namespace is::camera;
+using namespace std::chrono;
+
+using H = LatencyHistogram;
+
+// Every value lands in the bucket whose bounds hold it.
+void expect_bounded(uint64_t value) {
+  auto bucket = H::bucket(value);
+  EXPECT_LT(value, H::upper_bound(bucket)) << value;
+  if (bucket > 0)
+    EXPECT_GE(value, H::upper_bound(bucket - 1)) << value;
+}
+
+TEST(LatencyHistogram, SmallValuesHaveABucketEach) {
+  for (uint64_t us = 0; us < H::sub_buckets; ++us) {
+    EXPECT_EQ(H::bucket(us), us);
+    EXPECT_EQ(H::upper_bound(us), us + 1);
+  }
+  // 15 is the last exact bucket, 16 opens the first power of two
+  EXPECT_EQ(H::bucket(15), 15u);
+  EXPECT_EQ(H::bucket(16), 16u);
+  EXPECT_EQ(H::upper_bound(16), 17u);
+  EXPECT_EQ(H::bucket(31), 31u);
+  EXPECT_EQ(H::upper_bound(31), 32u);
+}
+
+TEST(LatencyHistogram, PowersOfTwoOpenSixteenBuckets) {
+  for (std::size_t k = 4; k < 36; ++k) {
+    auto power = uint64_t{1} << k;
+    auto first = H::sub_buckets * (k - 3);
+    EXPECT_EQ(H::bucket(power), first) << k;
+    EXPECT_EQ(H::bucket(power - 1), first - 1) << k;
+    EXPECT_EQ(H::upper_bound(first - 1), power) << k;
+    // a sixteenth of the power wide
+    EXPECT_EQ(H::upper_bound(first), power + (power >> 4)) << k;
+    expect_bounded(power);
+    expect_bounded(power - 1);
+    expect_bounded(power + (power >> 1) + 3);
+  }
+}
+
+TEST(LatencyHistogram, SaturatesAtTwoToTheThirtySix) {
+  auto max = uint64_t{1} << 36;
+  EXPECT_EQ(H::bucket(max - 1), H::size - 1);
+  EXPECT_EQ(H::upper_bound(H::size - 1), max);
+  EXPECT_EQ(H::bucket(max), H::size - 1);
+  EXPECT_EQ(H::bucket(UINT64_MAX), H::size - 1);
+}
+
+TEST(LatencyHistogram, PercentileIsTheUpperBoundOfTheBucketReachingTheRank) {
+  std::vector<uint64_t> counts(H::size, 0);
+  EXPECT_EQ(H::percentile(counts, 0.5), 0.0);
+  counts[10] = 90;  // below 11us
+  counts[16] = 9;   // below 17us
+  counts[32] = 1;   // below 34us
+  EXPECT_DOUBLE_EQ(H::percentile(counts, 0.5), 0.011);
+  EXPECT_DOUBLE_EQ(H::percentile(counts, 0.89), 0.011);
+  EXPECT_DOUBLE_EQ(H::percentile(counts, 0.9), 0.017);
+  EXPECT_DOUBLE_EQ(H::percentile(counts, 0.99), 0.034);
+  EXPECT_DOUBLE_EQ(H::percentile(counts, 0.999), 0.034);
+}
+
+TEST(LatencyHistogram, RecordsDurationsInMicroseconds) {
+  H histogram;
+  histogram.record(microseconds(10));
+  histogram.record(microseconds(-5));  // a clock step back counts as no time at all
+  std::vector<uint64_t> counts;
+  histogram.snapshot(&counts);
+  ASSERT_EQ(counts.size(), H::size);
+  EXPECT_EQ(counts[10], 1u);
+  EXPECT_EQ(counts[0], 1u);
+}
+
+StageLatency const& acquire(CameraGatewayMetrics const& metrics) {
+  return metrics.stages(static_cast<int>(Stage::ACQUIRE));
+}
+
+TEST(StageReport, PercentilesCoverOnlyTheFramesSinceThePreviousReport) {
+  StageLatencies latencies;
+  StageReport report;
+  CameraGatewayMetrics metrics;
+  for (int i = 0; i < 100; ++i) {
+    latencies[Stage::ACQUIRE].record(microseconds(10));
+  }
+  report.fill(latencies, &metrics);
+  ASSERT_EQ(metrics.stages_size(), static_cast<int>(stage_count));
+  EXPECT_EQ(acquire(metrics).stage(), "acquire");
+  EXPECT_DOUBLE_EQ(acquire(metrics).p50_ms(), 0.011);
+  EXPECT_EQ(acquire(metrics).count(), 100u);
+
+  for (int i = 0; i < 10; ++i) {
+    latencies[Stage::ACQUIRE].record(microseconds(1000));
+  }
+  report.fill(latencies, &metrics);
+  // 1000us lands in [992, 1024)
+  EXPECT_DOUBLE_EQ(acquire(metrics).p50_ms(), 1.024);
+  EXPECT_DOUBLE_EQ(acquire(metrics).p999_ms(), 1.024);
+  EXPECT_EQ(acquire(metrics).count(), 110u);
+
+  report.fill(latencies, &metrics);
+  EXPECT_EQ(acquire(metrics).p50_ms(), 0.0);
+  EXPECT_EQ(acquire(metrics).count(), 110u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
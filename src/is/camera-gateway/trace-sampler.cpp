@@ -0,0 +1,32 @@
+#include "trace-sampler.hpp"
+#include <is/wire/core/logger.hpp>
+
+namespace is {
+namespace camera {
+
+TraceSampler::TraceSampler(TracingOptions const& options)
+    : one_in(options.one_in()),
+      probability(options.probability()),
+      frames(0),
+      generator(std::random_device{}()),
+      uniform(0.0f, 1.0f) {
+  if (this->one_in > 0 && this->probability > 0) {
+    is::warn("[Tracing] Both one_in and probability set, sampling 1 in {} frames", this->one_in);
+    this->probability = 0;
+  }
+  if (this->one_in == 0 && this->probability <= 0)
+    this->one_in = 1;
+  if (this->one_in > 0)
+    is::info("[Tracing] Tracing 1 in {} frames", this->one_in);
+  else
+    is::info("[Tracing] Tracing frames with probability {}", this->probability);
+}
+
+bool TraceSampler::sample() {
+  if (this->one_in > 0)
+    return this->frames++ % this->one_in == 0;
+  return this->uniform(this->generator) < this->probability;
+}
+
+}  // namespace camera
+}  // namespace is
@@ -0,0 +1,29 @@
+#ifndef __IS_TRACE_SAMPLER_HPP__
+#define __IS_TRACE_SAMPLER_HPP__
+
+#include <cstdint>
+#include <random>
+#include "conf/options.pb.h"
+
+namespace is {
+namespace camera {
+
+// Decides which captures are traced, see TracingOptions. Only used by the capture thread.
+class TraceSampler {
+ public:
+  explicit TraceSampler(TracingOptions const& options);
+
+  bool sample();
+
+ private:
+  uint32_t one_in;
+  float probability;
+  uint64_t frames;
+  std::minstd_rand generator;
+  std::uniform_real_distribution<float> uniform;
+};
+
+}  // namespace camera
+}  // namespace is
+
+#endif  // __IS_TRACE_SAMPLER_HPP__